@@ -0,0 +1,320 @@
+#include "audio_convert.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+extern "C" {
+#include <libavutil/cpu.h>
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AUDIO_CONVERT_X86 1
+#include <immintrin.h>
+#define AUDIO_SSE2 __attribute__((target("sse2")))
+#define AUDIO_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace
+{
+  //和swr一样按当前舍入模式(就近取偶)取整再饱和,先限幅是为了不超出int的范围
+  inline int16_t float_to_s16(float v)
+  {
+    v = std::min(std::max(v, -32768.0f), 32767.0f);
+    return (int16_t)lrintf(v);
+  }
+
+  //packed格式各声道的数据本来就是交错的,整块转换,声道数只影响长度
+  void flt_c(const uint8_t *const *in, int16_t *out, int samples, int channels, float gain)
+  {
+    const float *src = (const float *)in[0];
+    const float scale = gain * 32768.0f;
+    int n = samples * channels;
+    for(int i = 0; i < n; i++)
+    {
+      out[i] = float_to_s16(src[i] * scale);
+    }
+  }
+
+  //CH为0时声道数由参数给出,单声道和立体声各自实例化,内层循环的步长是常数
+  template <int CH>
+  void fltp_c(const uint8_t *const *in, int16_t *out, int samples, int channels, float gain)
+  {
+    const int ch = CH ? CH : channels;
+    const float scale = gain * 32768.0f;
+    for(int c = 0; c < ch; c++)
+    {
+      const float *src = (const float *)in[c];
+      int16_t *dst = out + c;
+      for(int i = 0; i < samples; i++)
+      {
+        dst[i * ch] = float_to_s16(src[i] * scale);
+      }
+    }
+  }
+
+  void s16_copy(const uint8_t *const *in, int16_t *out, int samples, int channels, float)
+  {
+    memcpy(out, in[0], (size_t)samples * channels * sizeof(int16_t));
+  }
+
+  void s16_gain_c(const uint8_t *const *in, int16_t *out, int samples, int channels, float gain)
+  {
+    const int16_t *src = (const int16_t *)in[0];
+    int n = samples * channels;
+    for(int i = 0; i < n; i++)
+    {
+      out[i] = float_to_s16(src[i] * gain);
+    }
+  }
+
+  template <int CH>
+  void s16p_c(const uint8_t *const *in, int16_t *out, int samples, int channels, float gain)
+  {
+    const int ch = CH ? CH : channels;
+    bool unity = gain == 1.0f;
+    for(int c = 0; c < ch; c++)
+    {
+      const int16_t *src = (const int16_t *)in[c];
+      int16_t *dst = out + c;
+      for(int i = 0; i < samples; i++)
+      {
+        dst[i * ch] = unity ? src[i] : float_to_s16(src[i] * gain);
+      }
+    }
+  }
+
+#ifdef AUDIO_CONVERT_X86
+  //8个float -> 8个int16:乘上系数、限幅、就近取偶取整、饱和打包
+  AUDIO_SSE2 inline __m128i float_to_s16_sse2(__m128 a, __m128 b, __m128 scale)
+  {
+    const __m128 lo = _mm_set1_ps(-32768.0f);
+    const __m128 hi = _mm_set1_ps(32767.0f);
+    a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(a, scale), lo), hi);
+    b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(b, scale), lo), hi);
+    return _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+  }
+
+  //8个int16乘上增益,先符号扩展成int32再转成float,和标量版本的运算完全一样
+  AUDIO_SSE2 inline __m128i gain_s16_sse2(__m128i v, __m128 gain)
+  {
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+    return float_to_s16_sse2(_mm_cvtepi32_ps(lo), _mm_cvtepi32_ps(hi), gain);
+  }
+
+  AUDIO_SSE2 void flt_sse2(const uint8_t *const *in, int16_t *out, int samples, int channels, float gain)
+  {
+    const float *src = (const float *)in[0];
+    const float s = gain * 32768.0f;
+    const __m128 scale = _mm_set1_ps(s);
+    int n = samples * channels;
+    int i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+      __m128i v = float_to_s16_sse2(_mm_loadu_ps(src + i), _mm_loadu_ps(src + i + 4), scale);
+      _mm_storeu_si128((__m128i *)(out + i), v);
+    }
+    for(; i < n; i++)
+    {
+      out[i] = float_to_s16(src[i] * s);
+    }
+  }
+
+  AUDIO_SSE2 void fltp_stereo_sse2(const uint8_t *const *in, int16_t *out, int samples, int, float gain)
+  {
+    const float *l = (const float *)in[0];
+    const float *r = (const float *)in[1];
+    const float s = gain * 32768.0f;
+    const __m128 scale = _mm_set1_ps(s);
+    int i = 0;
+    for(; i + 8 <= samples; i += 8)
+    {
+      __m128i lv = float_to_s16_sse2(_mm_loadu_ps(l + i), _mm_loadu_ps(l + i + 4), scale);
+      __m128i rv = float_to_s16_sse2(_mm_loadu_ps(r + i), _mm_loadu_ps(r + i + 4), scale);
+      //左右声道各8个采样交错成LRLR...
+      _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi16(lv, rv));
+      _mm_storeu_si128((__m128i *)(out + 2 * i + 8), _mm_unpackhi_epi16(lv, rv));
+    }
+    for(; i < samples; i++)
+    {
+      out[2 * i] = float_to_s16(l[i] * s);
+      out[2 * i + 1] = float_to_s16(r[i] * s);
+    }
+  }
+
+  AUDIO_SSE2 void s16_gain_sse2(const uint8_t *const *in, int16_t *out, int samples, int channels, float gain)
+  {
+    const int16_t *src = (const int16_t *)in[0];
+    const __m128 g = _mm_set1_ps(gain);
+    int n = samples * channels;
+    int i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+      _mm_storeu_si128((__m128i *)(out + i), gain_s16_sse2(v, g));
+    }
+    for(; i < n; i++)
+    {
+      out[i] = float_to_s16(src[i] * gain);
+    }
+  }
+
+  AUDIO_SSE2 void s16p_stereo_sse2(const uint8_t *const *in, int16_t *out, int samples, int, float gain)
+  {
+    const int16_t *l = (const int16_t *)in[0];
+    const int16_t *r = (const int16_t *)in[1];
+    const __m128 g = _mm_set1_ps(gain);
+    bool unity = gain == 1.0f;
+    int i = 0;
+    for(; i + 8 <= samples; i += 8)
+    {
+      __m128i lv = _mm_loadu_si128((const __m128i *)(l + i));
+      __m128i rv = _mm_loadu_si128((const __m128i *)(r + i));
+      if(!unity)
+      {
+        lv = gain_s16_sse2(lv, g);
+        rv = gain_s16_sse2(rv, g);
+      }
+      _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi16(lv, rv));
+      _mm_storeu_si128((__m128i *)(out + 2 * i + 8), _mm_unpackhi_epi16(lv, rv));
+    }
+    for(; i < samples; i++)
+    {
+      out[2 * i] = unity ? l[i] : float_to_s16(l[i] * gain);
+      out[2 * i + 1] = unity ? r[i] : float_to_s16(r[i] * gain);
+    }
+  }
+
+  //16个float -> 16个int16;packs按128位的两半分别打包,结果的64位块顺序是a0 b0 a1 b1,调换中间两块恢复顺序
+  AUDIO_AVX2 inline __m256i float_to_s16_avx2(__m256 a, __m256 b, __m256 scale)
+  {
+    const __m256 lo = _mm256_set1_ps(-32768.0f);
+    const __m256 hi = _mm256_set1_ps(32767.0f);
+    a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(a, scale), lo), hi);
+    b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(b, scale), lo), hi);
+    __m256i v = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+    return _mm256_permute4x64_epi64(v, 0xD8);
+  }
+
+  AUDIO_AVX2 void flt_avx2(const uint8_t *const *in, int16_t *out, int samples, int channels, float gain)
+  {
+    const float *src = (const float *)in[0];
+    const float s = gain * 32768.0f;
+    const __m256 scale = _mm256_set1_ps(s);
+    int n = samples * channels;
+    int i = 0;
+    for(; i + 16 <= n; i += 16)
+    {
+      __m256i v = float_to_s16_avx2(_mm256_loadu_ps(src + i), _mm256_loadu_ps(src + i + 8), scale);
+      _mm256_storeu_si256((__m256i *)(out + i), v);
+    }
+    for(; i < n; i++)
+    {
+      out[i] = float_to_s16(src[i] * s);
+    }
+  }
+
+  AUDIO_AVX2 void fltp_stereo_avx2(const uint8_t *const *in, int16_t *out, int samples, int, float gain)
+  {
+    const float *l = (const float *)in[0];
+    const float *r = (const float *)in[1];
+    const float s = gain * 32768.0f;
+    const __m256 scale = _mm256_set1_ps(s);
+    int i = 0;
+    for(; i + 16 <= samples; i += 16)
+    {
+      __m256i lv = float_to_s16_avx2(_mm256_loadu_ps(l + i), _mm256_loadu_ps(l + i + 8), scale);
+      __m256i rv = float_to_s16_avx2(_mm256_loadu_ps(r + i), _mm256_loadu_ps(r + i + 8), scale);
+      //unpack也是在128位的两半里各自交错:lo是采样0-3和8-11,hi是4-7和12-15,再按128位重新拼成0-7和8-15
+      __m256i lo = _mm256_unpacklo_epi16(lv, rv);
+      __m256i hi = _mm256_unpackhi_epi16(lv, rv);
+      _mm256_storeu_si256((__m256i *)(out + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+      _mm256_storeu_si256((__m256i *)(out + 2 * i + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    for(; i < samples; i++)
+    {
+      out[2 * i] = float_to_s16(l[i] * s);
+      out[2 * i + 1] = float_to_s16(r[i] * s);
+    }
+  }
+#define X86_ONLY(f) f
+#else
+#define X86_ONLY(f) nullptr
+#endif
+
+  //一种转换的各指令集版本,按AudioIsa的顺序排列,没有的版本为空
+  struct Variants
+  {
+    AudioConvertFunc func[3];
+    const char *name[3];
+  };
+
+  AudioConverter pick(const Variants &v, AudioIsa isa)
+  {
+    int i = (int)isa;
+    //没有这个指令集的版本就退回到低一级,整数运算的转换AVX2带来的好处不大,只写了SSE2
+    while(i > 0 && !v.func[i])
+    {
+      i--;
+    }
+    AudioConverter c;
+    c.func = v.func[i];
+    c.name = v.name[i];
+    return c;
+  }
+
+  const Variants FLT = {{flt_c, X86_ONLY(flt_sse2), X86_ONLY(flt_avx2)}, {"flt_s16_c", "flt_s16_sse2", "flt_s16_avx2"}};
+  const Variants FLTP_STEREO = {{fltp_c<2>, X86_ONLY(fltp_stereo_sse2), X86_ONLY(fltp_stereo_avx2)},
+                                {"fltp_s16_stereo_c", "fltp_s16_stereo_sse2", "fltp_s16_stereo_avx2"}};
+  const Variants FLTP_ANY = {{fltp_c<0>, nullptr, nullptr}, {"fltp_s16_c", "", ""}};
+  const Variants S16_COPY = {{s16_copy, nullptr, nullptr}, {"s16_copy", "", ""}};
+  const Variants S16_GAIN = {{s16_gain_c, X86_ONLY(s16_gain_sse2), nullptr}, {"s16_gain_c", "s16_gain_sse2", ""}};
+  const Variants S16P_STEREO = {{s16p_c<2>, X86_ONLY(s16p_stereo_sse2), nullptr},
+                                {"s16p_s16_stereo_c", "s16p_s16_stereo_sse2", ""}};
+  const Variants S16P_ANY = {{s16p_c<0>, nullptr, nullptr}, {"s16p_s16_c", "", ""}};
+}
+
+AudioIsa best_audio_isa()
+{
+#ifdef AUDIO_CONVERT_X86
+  int flags = av_get_cpu_flags();
+  if(flags & AV_CPU_FLAG_AVX2)
+  {
+    return AudioIsa::AVX2;
+  }
+  if(flags & AV_CPU_FLAG_SSE2)
+  {
+    return AudioIsa::SSE2;
+  }
+#endif
+  return AudioIsa::C;
+}
+
+AudioConverter select_audio_converter(AVSampleFormat fmt, int channels, bool unity_gain, AudioIsa isa)
+{
+  if(channels <= 0)
+  {
+    return AudioConverter();
+  }
+  switch(fmt)
+  {
+    case AV_SAMPLE_FMT_FLT:
+      return pick(FLT, isa);
+    case AV_SAMPLE_FMT_FLTP:
+      //单声道的planar和packed是一样的内存布局
+      if(channels == 1)
+      {
+        return pick(FLT, isa);
+      }
+      return pick(channels == 2 ? FLTP_STEREO : FLTP_ANY, isa);
+    case AV_SAMPLE_FMT_S16:
+      return pick(unity_gain ? S16_COPY : S16_GAIN, isa);
+    case AV_SAMPLE_FMT_S16P:
+      if(channels == 1)
+      {
+        return pick(unity_gain ? S16_COPY : S16_GAIN, isa);
+      }
+      return pick(channels == 2 ? S16P_STEREO : S16P_ANY, isa);
+    default:
+      return AudioConverter();
+  }
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+extern "C" {
+#include <libavutil/samplefmt.h>
+}
+
+//音频转换函数用到的指令集
+enum class AudioIsa { C, SSE2, AVX2 };
+
+//把一帧解码输出转换成声卡要的交错S16,同时乘上增益
+//planar格式in是每个声道一个指针(frame->extended_data),packed格式只用in[0];samples是每个声道的采样数
+using AudioConvertFunc = void (*)(const uint8_t *const *in, int16_t *out, int samples, int channels, float gain);
+
+struct AudioConverter
+{
+  //为空表示这种格式没有快速路径,需要交给swr
+  AudioConvertFunc func{nullptr};
+  //选中的实现,例如"fltp_s16_stereo_avx2",用于日志和基准测试
+  const char *name{"swr"};
+};
+
+/*
+ * 采样率和声道布局不变时,音频只需要做格式转换(float -> int16)和交错,不需要swr通用的重采样流程
+ * 这里按输入格式和声道数(单声道、立体声各自特化,其余声道数走通用版本)在打开时选一次转换函数,
+ * 浮点格式有SSE2/AVX2版本,和swr一样按lrintf的方式舍入并饱和到int16,增益为1时结果和swr逐位一致
+ * 只支持FLT/FLTP/S16/S16P输入,其余格式返回空的func
+ */
+AudioConverter select_audio_converter(AVSampleFormat fmt, int channels, bool unity_gain, AudioIsa isa);
+
+//当前cpu支持的最好的指令集,由av_get_cpu_flags判断
+AudioIsa best_audio_isa();
@@ -0,0 +1,180 @@
+//音频格式转换微基准测试:对比swr_convert和audio_convert.h里各指令集的特化转换函数
+//用法: audio_convert_bench [--seconds S] [--frame-size N] [--gain G]
+//每种输入格式/声道数转换S秒(默认600)的48kHz音频,每次转换一帧N个采样(默认1024,和常见的aac帧一样)
+//每行输出吞吐量(百万采样/秒,按每个声道的采样数算)、相对swr的加速比,以及和swr输出不一致的采样数
+//增益为1时特化版本应该和swr逐位一致;swr没有增益,--gain不为1时swr的输出再乘一遍增益作为对照
+#include "../audio_convert.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libswresample/swresample.h>
+}
+
+namespace
+{
+  using Clock = std::chrono::steady_clock;
+  const int SAMPLE_RATE = 48000;
+  //输入数据的帧数,循环使用,避免整段数据都放进缓存里
+  const int INPUT_FRAMES = 64;
+
+  struct Case
+  {
+    AVSampleFormat fmt;
+    int channels;
+  };
+
+  //一种输入格式的测试数据,planar时每个声道一块,packed时只有一块
+  struct Input
+  {
+    std::vector<std::vector<uint8_t>> planes;
+    std::vector<const uint8_t *> frame_ptrs;
+  };
+
+  Input make_input(const Case &c, int frame_size)
+  {
+    bool planar = av_sample_fmt_is_planar(c.fmt);
+    int bps = av_get_bytes_per_sample(c.fmt);
+    int nb_planes = planar ? c.channels : 1;
+    size_t plane_samples = (size_t)frame_size * INPUT_FRAMES * (planar ? 1 : c.channels);
+    Input in;
+    in.planes.resize(nb_planes, std::vector<uint8_t>(plane_samples * bps));
+    //略微超出[-1,1]的正弦加噪声,覆盖饱和的情况
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> noise(-0.05f, 0.05f);
+    for(auto &plane : in.planes)
+    {
+      for(size_t i = 0; i < plane_samples; i++)
+      {
+        float v = 1.02f * sinf(i * 0.01f) + noise(rng);
+        if(bps == 4)
+        {
+          ((float *)plane.data())[i] = v;
+        }
+        else
+        {
+          ((int16_t *)plane.data())[i] = (int16_t)std::min(std::max(v * 32768.0f, -32768.0f), 32767.0f);
+        }
+      }
+    }
+    //每一帧每个平面的起始地址
+    for(int f = 0; f < INPUT_FRAMES; f++)
+    {
+      size_t offset = (size_t)f * frame_size * (planar ? 1 : c.channels) * bps;
+      for(auto &plane : in.planes)
+      {
+        in.frame_ptrs.push_back(plane.data() + offset);
+      }
+    }
+    return in;
+  }
+
+  //转换total_frames帧,返回耗时(秒);out保存最后一轮INPUT_FRAMES帧的输出,用来比较结果
+  template <typename Convert>
+  double run(int total_frames, int frame_size, int channels, const Input &in, std::vector<int16_t> &out, Convert convert)
+  {
+    size_t nb_planes = in.planes.size();
+    out.assign((size_t)frame_size * channels * INPUT_FRAMES, 0);
+    auto begin = Clock::now();
+    for(int i = 0; i < total_frames; i++)
+    {
+      int f = i % INPUT_FRAMES;
+      convert(&in.frame_ptrs[f * nb_planes], out.data() + (size_t)f * frame_size * channels);
+    }
+    return std::chrono::duration<double>(Clock::now() - begin).count();
+  }
+
+  size_t mismatches(const std::vector<int16_t> &a, const std::vector<int16_t> &b)
+  {
+    size_t n = 0;
+    for(size_t i = 0; i < a.size(); i++)
+    {
+      n += a[i] != b[i];
+    }
+    return n;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  double seconds = 600;
+  int frame_size = 1024;
+  float gain = 1.0f;
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+    {
+      seconds = atof(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--frame-size") == 0 && i + 1 < argc)
+    {
+      frame_size = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--gain") == 0 && i + 1 < argc)
+    {
+      gain = (float)atof(argv[++i]);
+    }
+  }
+  int total_frames = std::max(INPUT_FRAMES, (int)(seconds * SAMPLE_RATE / frame_size));
+  double total_samples = (double)total_frames * frame_size;
+  AudioIsa best = best_audio_isa();
+  const Case cases[] = {{AV_SAMPLE_FMT_FLTP, 2}, {AV_SAMPLE_FMT_FLTP, 1}, {AV_SAMPLE_FMT_FLT, 2},
+                        {AV_SAMPLE_FMT_FLTP, 6}, {AV_SAMPLE_FMT_S16P, 2}, {AV_SAMPLE_FMT_S16, 2}};
+
+  for(const Case &c : cases)
+  {
+    Input in = make_input(c, frame_size);
+    AVChannelLayout layout;
+    av_channel_layout_default(&layout, c.channels);
+    SwrContext *swr = NULL;
+    if(swr_alloc_set_opts2(&swr, &layout, AV_SAMPLE_FMT_S16, SAMPLE_RATE, &layout, c.fmt, SAMPLE_RATE, 0, NULL) < 0 ||
+       swr_init(swr) < 0)
+    {
+      fprintf(stderr, "初始化SwrContext失败\n");
+      return 1;
+    }
+    AudioConverter swr_gain = select_audio_converter(AV_SAMPLE_FMT_S16, c.channels, false, best);
+    std::vector<int16_t> expected;
+    double swr_time = run(total_frames, frame_size, c.channels, in, expected, [&](const uint8_t *const *src, int16_t *dst) {
+      uint8_t *out = (uint8_t *)dst;
+      swr_convert(swr, &out, frame_size, (const uint8_t **)src, frame_size);
+      if(gain != 1.0f)
+      {
+        swr_gain.func(&out, dst, frame_size, c.channels, gain);
+      }
+    });
+    swr_free(&swr);
+    av_channel_layout_uninit(&layout);
+    const char *fmt_name = av_get_sample_fmt_name(c.fmt);
+    printf("%-5s %dch %-24s 吞吐: %8.1f Msamples/s\n", fmt_name, c.channels, "swr", total_samples / swr_time / 1e6);
+
+    //同一个实现可能因为没有更高指令集的版本被重复选中,只测一次
+    const char *last = nullptr;
+    for(AudioIsa isa : {AudioIsa::C, AudioIsa::SSE2, AudioIsa::AVX2})
+    {
+      if((int)isa > (int)best)
+      {
+        break;
+      }
+      AudioConverter conv = select_audio_converter(c.fmt, c.channels, gain == 1.0f, isa);
+      if(!conv.func || (last && strcmp(last, conv.name) == 0))
+      {
+        continue;
+      }
+      last = conv.name;
+      std::vector<int16_t> out;
+      double t = run(total_frames, frame_size, c.channels, in, out, [&](const uint8_t *const *src, int16_t *dst) {
+        conv.func(src, dst, frame_size, c.channels, gain);
+      });
+      printf("%-5s %dch %-24s 吞吐: %8.1f Msamples/s  加速比: %5.2fx  和swr不一致的采样: %zu\n", fmt_name, c.channels,
+             conv.name, total_samples / t / 1e6, swr_time / t, mismatches(out, expected));
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,148 @@
+//视频解码多线程扩展性测试
+//用法: decode_bench [--max-threads N] [--type frame|slice|auto] file1 [file2 ...]
+//对每个文件分别用1..N个线程把视频流完整解码一遍,输出每种线程数下的解码帧率
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+  struct Result
+  {
+    int64_t frames{0};
+    double seconds{0};
+    int first_frame_packets{-1};
+  };
+
+  //把文件里的视频流全部解码一遍,不做任何显示
+  bool decode_file(const char *url, int threads, int thread_type, Result &result)
+  {
+    AVFormatContext *fmt = NULL;
+    if(avformat_open_input(&fmt, url, NULL, NULL) != 0)
+    {
+      fprintf(stderr, "打开媒体文件失败: %s\n", url);
+      return false;
+    }
+    if(avformat_find_stream_info(fmt, NULL) < 0)
+    {
+      avformat_close_input(&fmt);
+      return false;
+    }
+    const AVCodec *codec = NULL;
+    int index = av_find_best_stream(fmt, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if(index < 0 || !codec)
+    {
+      fprintf(stderr, "未找到视频流: %s\n", url);
+      avformat_close_input(&fmt);
+      return false;
+    }
+    AVCodecContext *ctx = avcodec_alloc_context3(codec);
+    avcodec_parameters_to_context(ctx, fmt->streams[index]->codecpar);
+    ctx->thread_count = threads;
+    ctx->thread_type = thread_type;
+    if(avcodec_open2(ctx, codec, NULL) < 0)
+    {
+      avcodec_free_context(&ctx);
+      avformat_close_input(&fmt);
+      return false;
+    }
+    AVPacket *pkt = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    int packets = 0;
+    auto begin = std::chrono::steady_clock::now();
+    bool eof = false;
+    while(!eof)
+    {
+      //读完后送一个空包把解码器里缓存的帧全部冲出来
+      if(av_read_frame(fmt, pkt) < 0)
+      {
+        eof = true;
+        avcodec_send_packet(ctx, NULL);
+      }
+      else if(pkt->stream_index != index)
+      {
+        av_packet_unref(pkt);
+        continue;
+      }
+      else
+      {
+        avcodec_send_packet(ctx, pkt);
+        av_packet_unref(pkt);
+        packets++;
+      }
+      while(avcodec_receive_frame(ctx, frame) >= 0)
+      {
+        if(result.first_frame_packets < 0)
+        {
+          result.first_frame_packets = packets;
+        }
+        result.frames++;
+        av_frame_unref(frame);
+      }
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    avcodec_free_context(&ctx);
+    avformat_close_input(&fmt);
+    return true;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int max_threads = std::thread::hardware_concurrency();
+  int thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  std::vector<const char *> files;
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--max-threads") == 0 && i + 1 < argc)
+    {
+      max_threads = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--type") == 0 && i + 1 < argc)
+    {
+      std::string type = argv[++i];
+      thread_type = type == "frame" ? FF_THREAD_FRAME : type == "slice" ? FF_THREAD_SLICE : (FF_THREAD_FRAME | FF_THREAD_SLICE);
+    }
+    else
+    {
+      files.push_back(argv[i]);
+    }
+  }
+  if(files.empty())
+  {
+    files.push_back("../a.flv");
+  }
+  av_log_set_level(AV_LOG_ERROR);
+  printf("file,threads,frames,seconds,fps,speedup,first_frame_packets\n");
+  for(const char *file : files)
+  {
+    double base_fps = 0;
+    for(int threads = 1; threads <= max_threads; threads++)
+    {
+      Result r;
+      if(!decode_file(file, threads, thread_type, r))
+      {
+        break;
+      }
+      double fps = r.frames / r.seconds;
+      if(threads == 1)
+      {
+        base_fps = fps;
+      }
+      printf("%s,%d,%lld,%.3f,%.1f,%.2f,%d\n", file, threads, (long long)r.frames, r.seconds, fps,
+             base_fps > 0 ? fps / base_fps : 0.0, r.first_frame_packets);
+      fflush(stdout);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,151 @@
+//demux吞吐测试: ffmpeg默认的file协议 vs mmap读取层
+//用法: demux_bench [--mode default|mmap|both] [--drop-cache] file1 [file2 ...]
+//对每个文件只做av_read_frame,不解码,输出CSV: 耗时、吞吐、read系统调用次数(/proc/self/io的syscr)和缺页次数
+//--drop-cache在每轮之前用posix_fadvise(DONTNEED)尽量把文件踢出页缓存,测冷读;多GB的文件才能看出差别
+#include "../mmap_io.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace
+{
+  struct IoCounters
+  {
+    long long syscr{0};
+    long long read_bytes{0};
+    long major_faults{0};
+    long minor_faults{0};
+  };
+
+  IoCounters read_counters()
+  {
+    IoCounters c;
+    FILE *f = fopen("/proc/self/io", "r");
+    if(f)
+    {
+      char key[64];
+      long long value;
+      while(fscanf(f, "%63[^:]: %lld\n", key, &value) == 2)
+      {
+        if(strcmp(key, "syscr") == 0)c.syscr = value;
+        else if(strcmp(key, "read_bytes") == 0)c.read_bytes = value;
+      }
+      fclose(f);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    c.major_faults = usage.ru_majflt;
+    c.minor_faults = usage.ru_minflt;
+    return c;
+  }
+
+  void drop_cache(const char *path)
+  {
+    int fd = open(path, O_RDONLY);
+    if(fd >= 0)
+    {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      close(fd);
+    }
+  }
+
+  //把文件的所有包读一遍,返回读到的字节数,失败返回-1
+  int64_t demux_file(const char *url, bool use_mmap, int64_t &packets)
+  {
+    MmapIO io;
+    AVFormatContext *fmt = NULL;
+    if(use_mmap)
+    {
+      if(!io.open(url))
+      {
+        fprintf(stderr, "mmap打开失败: %s\n", url);
+        return -1;
+      }
+      fmt = avformat_alloc_context();
+      fmt->pb = io.context();
+    }
+    if(avformat_open_input(&fmt, url, NULL, NULL) != 0)
+    {
+      fprintf(stderr, "打开媒体文件失败: %s\n", url);
+      return -1;
+    }
+    int64_t bytes = 0;
+    packets = 0;
+    AVPacket *pkt = av_packet_alloc();
+    while(av_read_frame(fmt, pkt) >= 0)
+    {
+      bytes += pkt->size;
+      packets++;
+      av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+    avformat_close_input(&fmt);
+    return bytes;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  std::string mode = "both";
+  bool cold = false;
+  std::vector<const char *> files;
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--mode") == 0 && i + 1 < argc)
+    {
+      mode = argv[++i];
+    }
+    else if(strcmp(argv[i], "--drop-cache") == 0)
+    {
+      cold = true;
+    }
+    else
+    {
+      files.push_back(argv[i]);
+    }
+  }
+  if(files.empty())
+  {
+    files.push_back("../a.flv");
+  }
+  av_log_set_level(AV_LOG_ERROR);
+
+  std::vector<bool> modes;
+  if(mode != "mmap")modes.push_back(false);
+  if(mode != "default")modes.push_back(true);
+
+  printf("file,mode,seconds,packets,mb,mb_per_s,syscr,disk_read_mb,major_faults,minor_faults\n");
+  for(const char *file : files)
+  {
+    for(bool use_mmap : modes)
+    {
+      if(cold)
+      {
+        drop_cache(file);
+      }
+      IoCounters before = read_counters();
+      auto begin = std::chrono::steady_clock::now();
+      int64_t packets = 0;
+      int64_t bytes = demux_file(file, use_mmap, packets);
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+      IoCounters after = read_counters();
+      if(bytes < 0)
+      {
+        continue;
+      }
+      double mb = bytes / (1024.0 * 1024.0);
+      printf("%s,%s,%.3f,%lld,%.1f,%.1f,%lld,%.1f,%ld,%ld\n", file, use_mmap ? "mmap" : "default", seconds,
+             (long long)packets, mb, mb / seconds, after.syscr - before.syscr,
+             (after.read_bytes - before.read_bytes) / (1024.0 * 1024.0), after.major_faults - before.major_faults,
+             after.minor_faults - before.minor_faults);
+      fflush(stdout);
+    }
+  }
+  return 0;
+}
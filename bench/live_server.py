@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+# 直播源的替身: 用http按实时码率推送一个本地文件,用来测试播放器的直播模式
+# 用法: live_server.py file [--port 8080] [--duration SEC | --bitrate BPS] [--burst SEC]
+#                      [--jitter MS] [--stall-every SEC --stall MS]
+# 码率 = 文件大小 / 时长,时长默认用ffprobe读取;--burst先一次性发出这么多秒的数据,模拟服务器的首屏缓存
+# --jitter让每次发送的时间随机抖动,--stall-every/--stall每隔一段时间断流一次,观察重新缓冲
+# 例: python3 live_server.py ../a.flv --stall-every 10 --stall 1500 &
+#     ./player_bench --live http://127.0.0.1:8080/live.flv
+import argparse
+import http.server
+import os
+import random
+import subprocess
+import sys
+import time
+
+CHUNK_INTERVAL = 0.02
+
+
+def probe_duration(path):
+    out = subprocess.run(
+        ["ffprobe", "-v", "error", "-show_entries", "format=duration", "-of", "csv=p=0", path],
+        capture_output=True, text=True, check=True)
+    return float(out.stdout.strip())
+
+
+def make_handler(args, rate):
+    class Handler(http.server.BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.0"
+
+        def do_GET(self):
+            self.send_response(200)
+            self.send_header("Content-Type", "video/x-flv")
+            self.send_header("Cache-Control", "no-cache")
+            self.end_headers()
+            begin = time.monotonic()
+            next_stall = begin + args.stall_every if args.stall_every > 0 else None
+            sent = 0
+            burst = int(rate * args.burst)
+            try:
+                with open(args.file, "rb") as f:
+                    while True:
+                        now = time.monotonic()
+                        if next_stall is not None and now >= next_stall:
+                            # 模拟网络卡顿: 这段时间什么都不发,恢复后积压的数据一下子到达
+                            time.sleep(args.stall / 1000.0)
+                            next_stall += args.stall_every
+                            continue
+                        # 按实时码率算出到现在为止应该发出去多少字节
+                        due = burst + int(rate * (now - begin))
+                        if due > sent:
+                            data = f.read(due - sent)
+                            if not data:
+                                break
+                            self.wfile.write(data)
+                            self.wfile.flush()
+                            sent += len(data)
+                        delay = CHUNK_INTERVAL
+                        if args.jitter > 0:
+                            delay += random.uniform(0, args.jitter / 1000.0)
+                        time.sleep(delay)
+            except (BrokenPipeError, ConnectionResetError):
+                pass
+
+        def log_message(self, fmt, *a):
+            sys.stderr.write("live_server: " + fmt % a + "\n")
+
+    return Handler
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("file")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--duration", type=float, default=0)
+    parser.add_argument("--bitrate", type=float, default=0, help="bits per second")
+    parser.add_argument("--burst", type=float, default=0.0)
+    parser.add_argument("--jitter", type=float, default=0.0)
+    parser.add_argument("--stall-every", type=float, default=0.0)
+    parser.add_argument("--stall", type=float, default=0.0)
+    args = parser.parse_args()
+
+    if args.bitrate > 0:
+        rate = args.bitrate / 8
+    else:
+        duration = args.duration if args.duration > 0 else probe_duration(args.file)
+        rate = os.path.getsize(args.file) / duration
+    sys.stderr.write("live_server: %s at %.1f KB/s on port %d\n" % (args.file, rate / 1024, args.port))
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", args.port), make_handler(args, rate))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,151 @@
+//多路流并发测试:同一进程里同时播放N路,对比共享执行器和每路各开线程两种方式的总吞吐
+//用法: multi_bench [--streams 1,4,16,64] [--workers N] [--mode executor|threads|both] [--sample S] [--output-size WxH]
+//                   file1 [file2 ...]
+//--output-size模拟监控墙的小窗口,每一路都转换到这个大小(例如854x480)
+//所有流都是无头不限速的,文件数不够时循环使用,文件最好足够长,保证--sample秒(默认2秒)时所有流都还在播放
+//结果以CSV输出到标准错误(播放器自己的日志在标准输出上):
+//mode,streams,workers,wall_seconds,frames,aggregate_fps,min_stream_fps,max_stream_fps,fairness,cpu_seconds,steals
+//fairness = 第sample秒时各路已显示帧数的最小值/最大值,越接近1说明各路分到的算力越平均
+#include "../player.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+
+namespace
+{
+  double process_cpu_seconds()
+  {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+  }
+
+  bool run(bool use_executor, int streams, int workers, double sample, int output_width, int output_height,
+           const std::vector<const char *> &files)
+  {
+    std::unique_ptr<Executor> executor;
+    if(use_executor)
+    {
+      executor.reset(new Executor(workers));
+    }
+    PlayerOptions options;
+    options.headless = true;
+    options.executor = executor.get();
+    options.output_width = output_width;
+    options.output_height = output_height;
+    std::vector<std::unique_ptr<MediaPlayer>> players;
+    for(int i = 0; i < streams; i++)
+    {
+      const char *url = files[i % files.size()];
+      players.emplace_back(new MediaPlayer(url, DEFAULT_AV_SYNC_TYPE, options));
+      if(!players.back()->is_opened())
+      {
+        fprintf(stderr, "打开失败: %s\n", url);
+        return false;
+      }
+    }
+
+    double cpu_begin = process_cpu_seconds();
+    auto begin = std::chrono::steady_clock::now();
+    for(auto &p : players)
+    {
+      p->start_async();
+    }
+    //运行中途看一眼各路的进度,衡量公平性
+    std::this_thread::sleep_until(begin + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                              std::chrono::duration<double>(sample)));
+    uint64_t min_frames = UINT64_MAX, max_frames = 0;
+    for(auto &p : players)
+    {
+      uint64_t frames = p->stats().rendered_frames;
+      min_frames = std::min(min_frames, frames);
+      max_frames = std::max(max_frames, frames);
+    }
+    for(auto &p : players)
+    {
+      p->wait();
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    double cpu = process_cpu_seconds() - cpu_begin;
+    uint64_t total = 0;
+    for(auto &p : players)
+    {
+      total += p->stats().rendered_frames;
+    }
+    //播放器要在执行器之前析构
+    players.clear();
+    int threads = executor ? executor->threads() : 0;
+    uint64_t steals = executor ? executor->stats().steals : 0;
+
+    fprintf(stderr, "%s,%d,%d,%.3f,%llu,%.1f,%.1f,%.1f,%.3f,%.2f,%llu\n", use_executor ? "executor" : "threads", streams,
+            threads, wall, (unsigned long long)total, total / wall, min_frames / sample, max_frames / sample,
+            max_frames > 0 ? (double)min_frames / max_frames : 0.0, cpu, (unsigned long long)steals);
+    return true;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  std::vector<int> stream_counts = {1, 4, 16, 64};
+  int workers = 0;
+  double sample = 2.0;
+  int output_width = 0, output_height = 0;
+  std::string mode = "both";
+  std::vector<const char *> files;
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--streams") == 0 && i + 1 < argc)
+    {
+      stream_counts.clear();
+      for(char *tok = strtok(argv[++i], ","); tok; tok = strtok(NULL, ","))
+      {
+        stream_counts.push_back(atoi(tok));
+      }
+    }
+    else if(strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+    {
+      workers = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--mode") == 0 && i + 1 < argc)
+    {
+      mode = argv[++i];
+    }
+    else if(strcmp(argv[i], "--sample") == 0 && i + 1 < argc)
+    {
+      sample = atof(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--output-size") == 0 && i + 1 < argc)
+    {
+      sscanf(argv[++i], "%dx%d", &output_width, &output_height);
+    }
+    else
+    {
+      files.push_back(argv[i]);
+    }
+  }
+  if(files.empty())
+  {
+    files.push_back("../a.flv");
+  }
+  av_log_set_level(AV_LOG_ERROR);
+
+  fprintf(stderr, "mode,streams,workers,wall_seconds,frames,aggregate_fps,min_stream_fps,max_stream_fps,fairness,cpu_seconds,steals\n");
+  for(int streams : stream_counts)
+  {
+    if(mode != "threads" && !run(true, streams, workers, sample, output_width, output_height, files))
+    {
+      return 1;
+    }
+    if(mode != "executor" && !run(false, streams, workers, sample, output_width, output_height, files))
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,306 @@
+//无头端到端吞吐测试
+//用法: player_bench [--decode-threads N] [--convert-threads N] [--paced] [--audio-skew R]
+//                    [--seek N] [--accurate-seek] [--no-index] [--probesize BYTES] [--analyzeduration US]
+//                    [--no-stream-cache] [--mmap-io] [--live] [--live-latency S] [--quit-after S] [--max-shutdown-ms X]
+//                    [--output-size WxH] [--record out.mkv] [--record-limit MB] [--gain G] [--scrub N] [--output result.json] [file]
+//跑完整的 readData -> video_thread/audio_thread -> 格式转换 流水线,视频和音频都输出到空设备,默认不限速
+//--paced时按时钟节奏显示和消费音频,用来测量显示时间误差
+//--audio-skew让模拟声卡比标称采样率快R(例如0.002),长片子上看av_drift是否稳定在同步阈值以内
+//--seek N在播放过程中每隔300ms随机seek一次,共N次,统计seek到新位置第一帧显示的耗时
+//--live按直播流播放(隐含--paced),配合bench/live_server.py按实时码率推送的http流,统计缓冲延迟和断流次数
+//--output-size WxH按监控墙上小窗口的大小输出(例如854x480),对比cpu时间和格式转换耗时,0表示按比例
+//--record边播边录,看录制是否拖慢播放;--record-limit调小录制缓冲,配合慢速磁盘看丢包计数
+//--gain G按G倍音量输出,audio_fast_frames是没有经过swr、直接转换的音频帧数
+//--scrub N模拟来回拖动(配合--paced):播放1秒后倒放2秒,再随机逐帧前后移动N次,然后继续播放,gop_cache是GOP缓存的命中率和内存
+//  resume_error_ms是继续播放后的第一帧和停下的画面的pts之差(继续播放后没有显示出画面时为-1),超过1ms或者为-1时返回1
+//--quit-after S在播放S秒后调用quit(),shutdown_ms是从quit()到start()返回的时间,应该在几毫秒以内
+//指定--max-shutdown-ms时shutdown_ms超过X毫秒就返回1,可以在CI里卡住退出变慢的退化
+//不加--quit-after时播放到文件末尾,drained_frames是结束时从解码器里冲出来的帧数
+//结果以一行JSON输出到标准输出的最后一行,指定--output时同时写入文件
+#include "../player.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <sys/resource.h>
+
+int main(int argc, char *argv[])
+{
+  const char *url = "../a.flv";
+  const char *output = NULL;
+  int seeks = 0;
+  int scrubs = 0;
+  double quit_after = -1;
+  double max_shutdown_ms = -1;
+  PlayerOptions options;
+  options.headless = true;
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--decode-threads") == 0 && i + 1 < argc)
+    {
+      options.decode_threads = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--convert-threads") == 0 && i + 1 < argc)
+    {
+      options.convert_threads = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--paced") == 0)
+    {
+      options.headless_paced = true;
+    }
+    else if(strcmp(argv[i], "--audio-skew") == 0 && i + 1 < argc)
+    {
+      options.headless_paced = true;
+      options.audio_clock_skew = atof(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--seek") == 0 && i + 1 < argc)
+    {
+      seeks = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--probesize") == 0 && i + 1 < argc)
+    {
+      options.probesize = atoll(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--analyzeduration") == 0 && i + 1 < argc)
+    {
+      options.analyzeduration = atoll(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--no-stream-cache") == 0)
+    {
+      options.stream_cache = false;
+    }
+    else if(strcmp(argv[i], "--mmap-io") == 0)
+    {
+      options.mmap_io = true;
+    }
+    else if(strcmp(argv[i], "--no-index") == 0)
+    {
+      options.keyframe_index = false;
+    }
+    else if(strcmp(argv[i], "--accurate-seek") == 0)
+    {
+      options.accurate_seek = true;
+    }
+    else if(strcmp(argv[i], "--live") == 0)
+    {
+      //直播必须按时钟节奏播放,否则缓冲延迟没有意义
+      options.live = true;
+      options.headless_paced = true;
+    }
+    else if(strcmp(argv[i], "--live-latency") == 0 && i + 1 < argc)
+    {
+      options.live_latency = atof(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--output-size") == 0 && i + 1 < argc)
+    {
+      sscanf(argv[++i], "%dx%d", &options.output_width, &options.output_height);
+    }
+    else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+    {
+      options.record_path = argv[++i];
+    }
+    else if(strcmp(argv[i], "--record-limit") == 0 && i + 1 < argc)
+    {
+      options.record_limits.max_bytes = (int64_t)(atof(argv[++i]) * 1024 * 1024);
+    }
+    else if(strcmp(argv[i], "--gain") == 0 && i + 1 < argc)
+    {
+      options.audio_gain = (float)atof(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--scrub") == 0 && i + 1 < argc)
+    {
+      scrubs = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--quit-after") == 0 && i + 1 < argc)
+    {
+      quit_after = atof(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--max-shutdown-ms") == 0 && i + 1 < argc)
+    {
+      max_shutdown_ms = atof(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+    {
+      output = argv[++i];
+    }
+    else
+    {
+      url = argv[i];
+    }
+  }
+  av_log_set_level(AV_LOG_ERROR);
+
+  MediaPlayer player(url, DEFAULT_AV_SYNC_TYPE, options);
+  if(!player.is_opened())
+  {
+    fprintf(stderr, "打开失败: %s\n", url);
+    return 1;
+  }
+  std::atomic_bool done{false};
+  std::thread seeker([&]() {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> dist(0, player.duration() * 0.9);
+    for(int i = 0; i < seeks && !done; i++)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(300));
+      player.seek(dist(rng));
+    }
+  });
+  std::thread scrubber([&]() {
+    if(scrubs <= 0)
+    {
+      return;
+    }
+    //睡眠期间播放结束了返回false
+    auto sleep = [&](double seconds) {
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                            std::chrono::duration<double>(seconds));
+      while(!done && std::chrono::steady_clock::now() < deadline)
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      return !done;
+    };
+    if(!sleep(1.0))
+    {
+      return;
+    }
+    player.play_reverse(true);
+    if(!sleep(2.0))
+    {
+      return;
+    }
+    player.play_reverse(false);
+    //往回退的多一些,跨过GOP边界时看后台提前解码有没有赶上
+    std::mt19937 rng(2);
+    std::uniform_int_distribution<int> dist(-3, 2);
+    for(int i = 0; i < scrubs; i++)
+    {
+      if(!sleep(0.02))
+      {
+        return;
+      }
+      int n = dist(rng);
+      player.step(n == 0 ? -1 : n);
+    }
+    player.resume();
+  });
+  auto begin = std::chrono::steady_clock::now();
+  //quit_time在quit()之前写入,start()返回之后才读取
+  std::atomic<double> quit_time{NAN};
+  std::thread quitter;
+  if(quit_after >= 0)
+  {
+    quitter = std::thread([&]() {
+      auto deadline = begin + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                  std::chrono::duration<double>(quit_after));
+      while(!done && std::chrono::steady_clock::now() < deadline)
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      if(done)
+      {
+        return;
+      }
+      quit_time = monotonic_now();
+      player.quit();
+    });
+  }
+  player.start();
+  double end = monotonic_now();
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  done = true;
+  seeker.join();
+  scrubber.join();
+  double shutdown_ms = -1;
+  if(quitter.joinable())
+  {
+    quitter.join();
+    //文件比quit_after短时已经自己播完了
+    if(!std::isnan(quit_time.load()))
+    {
+      shutdown_ms = std::max(end - quit_time, 0.0) * 1000;
+    }
+  }
+
+  PipelineStats st = player.stats();
+  const Histogram &present = player.get_metrics().present_error;
+  const Histogram &callback = player.get_metrics().stages[(int)Stage::AUDIO_CALLBACK];
+  const Histogram &drift = player.get_metrics().av_drift;
+  const Histogram &seek = player.get_metrics().seek_latency;
+  const Histogram &live = player.get_metrics().live_latency;
+  const GopCacheStats &gc = st.gop_cache;
+  //没有继续播放过时为0,继续播放后没有显示出画面时为NAN
+  double resume_error = std::isnan(st.resume_pts) ? 0 : std::fabs(st.resume_first_pts - st.resume_pts);
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  char json[3072];
+  snprintf(json, sizeof(json),
+           "{\"file\":\"%s\",\"wall_seconds\":%.3f,"
+           "\"open_ms\":%.1f,\"ttff_ms\":%.1f,\"ttfa_ms\":%.1f,\"stream_cache_hit\":%s,"
+           "\"demux_bytes\":%llu,\"demux_mb_per_s\":%.2f,"
+           "\"decoded_frames\":%llu,\"video_frames\":%llu,\"decoded_fps\":%.1f,"
+           "\"audio_samples\":%llu,\"audio_samples_per_s\":%.0f,"
+           "\"cpu_seconds\":{\"demux\":%.3f,\"video_decode\":%.3f,\"audio_decode\":%.3f,\"video_sink\":%.3f,\"audio_sink\":%.3f},"
+           "\"present_error_us\":{\"p50\":%.1f,\"p99\":%.1f,\"max\":%.1f},"
+           "\"audio_callback_us\":{\"p99\":%.1f,\"max\":%.1f},"
+           "\"av_drift_ms\":{\"p50\":%.2f,\"p99\":%.2f,\"max\":%.2f},\"audio_compensated_frames\":%llu,"
+           "\"audio_fast_frames\":%llu,"
+           "\"seek_ms\":{\"count\":%llu,\"indexed\":%llu,\"p50\":%.2f,\"p99\":%.2f,\"max\":%.2f},"
+           "\"live_latency_ms\":{\"p50\":%.1f,\"p99\":%.1f,\"max\":%.1f},\"live_underruns\":%llu,\"live_jumps\":%llu,"
+           "\"drained_frames\":%llu,\"shutdown_ms\":%.2f,"
+           "\"record\":{\"packets\":%llu,\"mb\":%.2f,\"dropped\":%llu,\"skipped\":%llu},"
+           "\"gop_cache\":{\"hits\":%llu,\"misses\":%llu,\"hit_rate\":%.3f,\"gops_decoded\":%llu,\"prefetched\":%llu,"
+           "\"evictions\":%llu,\"mb\":%.1f,\"peak_mb\":%.1f,\"decode_ms_per_gop\":%.2f,\"resume_error_ms\":%.3f},"
+           "\"shell_allocations\":%llu,\"peak_rss_mb\":%.1f}",
+           url, wall, st.open_seconds * 1000, st.time_to_first_frame * 1000, st.time_to_first_audio * 1000,
+           st.stream_cache_hit ? "true" : "false",
+           (unsigned long long)st.demux_bytes, st.demux_bytes / wall / (1024 * 1024),
+           (unsigned long long)st.decoded_frames, (unsigned long long)st.rendered_frames, st.decoded_frames / wall,
+           (unsigned long long)st.audio_samples, st.audio_samples / wall,
+           st.demux_cpu, st.video_decode_cpu, st.audio_decode_cpu, st.video_sink_cpu, st.audio_sink_cpu,
+           present.percentile(0.5) / 1000.0, present.percentile(0.99) / 1000.0, present.max() / 1000.0,
+           callback.percentile(0.99) / 1000.0, callback.max() / 1000.0,
+           drift.percentile(0.5) / 1e6, drift.percentile(0.99) / 1e6, drift.max() / 1e6,
+           (unsigned long long)st.audio_compensated_frames, (unsigned long long)st.audio_fast_frames,
+           (unsigned long long)seek.count(), (unsigned long long)st.indexed_seeks, seek.percentile(0.5) / 1e6, seek.percentile(0.99) / 1e6, seek.max() / 1e6,
+           live.percentile(0.5) / 1e6, live.percentile(0.99) / 1e6, live.max() / 1e6,
+           (unsigned long long)st.live_underruns, (unsigned long long)st.live_jumps,
+           (unsigned long long)st.drained_frames, shutdown_ms,
+           (unsigned long long)st.record.packets_written, st.record.bytes_written / (1024.0 * 1024.0),
+           (unsigned long long)st.record.packets_dropped, (unsigned long long)st.record.packets_skipped,
+           (unsigned long long)gc.hits, (unsigned long long)gc.misses,
+           gc.hits + gc.misses ? (double)gc.hits / (gc.hits + gc.misses) : 0.0, (unsigned long long)gc.gops_decoded,
+           (unsigned long long)gc.gops_prefetched, (unsigned long long)gc.evictions, gc.bytes / (1024.0 * 1024.0),
+           gc.peak_bytes / (1024.0 * 1024.0), gc.gops_decoded ? gc.decode_seconds * 1000 / gc.gops_decoded : 0.0,
+           std::isnan(resume_error) ? -1.0 : resume_error * 1000,
+           (unsigned long long)st.shell_allocations, usage.ru_maxrss / 1024.0);
+  printf("%s\n", json);
+  if(output)
+  {
+    FILE *f = fopen(output, "w");
+    if(f)
+    {
+      fprintf(f, "%s\n", json);
+      fclose(f);
+    }
+  }
+  if(!(resume_error <= 0.001))
+  {
+    fprintf(stderr, "继续播放后的第一帧 %.3fs 和停下的画面 %.3fs 不一致\n", st.resume_first_pts, st.resume_pts);
+    return 1;
+  }
+  if(max_shutdown_ms >= 0 && shutdown_ms > max_shutdown_ms)
+  {
+    fprintf(stderr, "退出耗时 %.2fms 超过了 %.2fms\n", shutdown_ms, max_shutdown_ms);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,130 @@
+//对比旧的 std::queue+mutex+condition_variable 和 SpscQueue 的吞吐量与唤醒延迟
+#include "../spsc_queue.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace
+{
+  const int QUEUE_SIZE = 1024;
+  using Clock = std::chrono::steady_clock;
+
+  int64_t now_ns()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+  }
+
+  //模拟播放器原来的队列:每次push都notify_all,满了丢弃最旧的数据
+  class LockedQueue {
+  public:
+    void push(int64_t v)
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      if(q_.size() >= QUEUE_SIZE)
+      {
+        q_.pop();
+      }
+      q_.push(v);
+      cond_.notify_all();
+    }
+    bool pop(int64_t &v)
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      cond_.wait_for(lock, std::chrono::milliseconds(1000), [&](){
+        return !q_.empty();
+      });
+      if(q_.empty())return false;
+      v = q_.front();
+      q_.pop();
+      return true;
+    }
+  private:
+    std::queue<int64_t> q_;
+    std::mutex mtx_;
+    std::condition_variable cond_;
+  };
+
+  class LockFreeQueue {
+  public:
+    void push(int64_t v) { q_.push(v, std::chrono::milliseconds(-1)); }
+    bool pop(int64_t &v) { return q_.pop(v, std::chrono::milliseconds(1000)); }
+  private:
+    SpscQueue<int64_t> q_{QUEUE_SIZE};
+  };
+
+  //生产者全速写入,测吞吐
+  template <typename Q>
+  double throughput(int64_t n)
+  {
+    Q q;
+    int64_t received = 0;
+    auto begin = Clock::now();
+    std::thread consumer([&](){
+      int64_t v;
+      //-1作为结束标记,它是最后写入的,旧队列丢弃最旧数据时也不会丢掉它
+      while(q.pop(v) && v >= 0)
+      {
+        received++;
+      }
+    });
+    for(int64_t i = 0; i < n; i++)
+    {
+      q.push(i);
+    }
+    q.push(-1);
+    consumer.join();
+    double sec = std::chrono::duration<double>(Clock::now() - begin).count();
+    return received / sec;
+  }
+
+  //生产者每隔一段时间写一个数据,消费者每次都处在等待状态,测从push到pop返回的延迟
+  template <typename Q>
+  std::vector<int64_t> wakeup_latency(int n, std::chrono::microseconds interval)
+  {
+    Q q;
+    std::vector<int64_t> lat;
+    lat.reserve(n);
+    std::thread consumer([&](){
+      int64_t v;
+      for(int i = 0; i < n && q.pop(v); i++)
+      {
+        lat.push_back(now_ns() - v);
+      }
+    });
+    for(int i = 0; i < n; i++)
+    {
+      std::this_thread::sleep_for(interval);
+      q.push(now_ns());
+    }
+    consumer.join();
+    std::sort(lat.begin(), lat.end());
+    return lat;
+  }
+
+  template <typename Q>
+  void run(const char *name, int64_t n, int wakeups)
+  {
+    double ops = throughput<Q>(n);
+    std::vector<int64_t> lat = wakeup_latency<Q>(wakeups, std::chrono::microseconds(200));
+    auto pct = [&](double p) {
+      return lat.empty() ? 0.0 : lat[std::min(lat.size() - 1, (size_t)(p * lat.size()))] / 1000.0;
+    };
+    printf("%-18s 吞吐: %8.2f Mops/s  唤醒延迟(us) p50: %7.2f p99: %7.2f max: %7.2f\n",
+           name, ops / 1e6, pct(0.50), pct(0.99), pct(1.0));
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int64_t n = argc > 1 ? atoll(argv[1]) : 10000000;
+  int wakeups = argc > 2 ? atoi(argv[2]) : 5000;
+  run<LockedQueue>("mutex+cond", n, wakeups);
+  run<LockFreeQueue>("spsc+futex", n, wakeups);
+  return 0;
+}
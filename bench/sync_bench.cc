@@ -0,0 +1,220 @@
+//音视频同步精度测试:无头按时钟节奏播放,模拟声卡按精确(或者故意偏快/偏慢)的采样率消费音频
+//用法: sync_bench [--types audio,video,external] [--skew R] [--duration S] [--csv-prefix P] [--max-p99-ms X] [file]
+//每种同步方式各播放一遍(默认前30秒),逐帧记录showFrame的diff/delay/actual_delay和synchronize_audio的avg_diff,
+//写到P_<type>.csv(默认P为sync),可以直接画出以前手工画的diff变化图
+//每种同步方式在标准输出上输出一行JSON汇总(和播放器的日志混在一起,按行首的{过滤):
+//  av_diff_ms: 显示时刻视频pts和音频时钟之差的绝对值,即实际看到和听到的偏差
+//  late_actual_delay_ms: 显示晚了的帧(转换上传之后actual_delay为负)晚了多少
+//  avg_diff_ms: synchronize_audio里平滑后的误差(音频为主时没有)
+//指定--max-p99-ms时任一同步方式的av_diff p99超过X毫秒就返回1,可以在CI里卡住同步的退化
+#include "../player.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+  struct Percentiles
+  {
+    size_t count{0};
+    double p50{0};
+    double p95{0};
+    double p99{0};
+    double max{0};
+  };
+
+  //取绝对值后按最近秩计算分位数,NAN(还没有时钟)不计入
+  Percentiles percentiles(std::vector<double> v)
+  {
+    v.erase(std::remove_if(v.begin(), v.end(), [](double x) { return std::isnan(x); }), v.end());
+    Percentiles p;
+    p.count = v.size();
+    if(v.empty())
+    {
+      return p;
+    }
+    for(double &x : v)
+    {
+      x = std::fabs(x);
+    }
+    std::sort(v.begin(), v.end());
+    auto at = [&](double q) { return v[std::min(v.size() - 1, (size_t)(q * v.size()))]; };
+    p.p50 = at(0.5);
+    p.p95 = at(0.95);
+    p.p99 = at(0.99);
+    p.max = v.back();
+    return p;
+  }
+
+  std::string to_json(const Percentiles &p)
+  {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "{\"count\":%zu,\"p50\":%.3f,\"p95\":%.3f,\"p99\":%.3f,\"max\":%.3f}", p.count,
+             p.p50 * 1000, p.p95 * 1000, p.p99 * 1000, p.max * 1000);
+    return buf;
+  }
+
+  const char *type_name(AV_SYNC_TYPE type)
+  {
+    switch(type)
+    {
+      case AV_SYNC_TYPE::AV_SYNC_AUDIO_MASTER:
+        return "audio";
+      case AV_SYNC_TYPE::AV_SYNC_VIDEO_MASTER:
+        return "video";
+      case AV_SYNC_TYPE::AV_SYNC_EXTERNAL_MASTER:
+        return "external";
+    }
+    return "unknown";
+  }
+
+  //播放一遍,返回av_diff的p99(秒),失败返回NAN
+  double run(const char *url, AV_SYNC_TYPE type, double skew, double duration, const std::string &csv_prefix)
+  {
+    SyncTrace trace;
+    PlayerOptions options;
+    options.headless = true;
+    options.headless_paced = true;
+    options.audio_clock_skew = skew;
+    options.sync_trace = &trace;
+    MediaPlayer player(url, type, options);
+    if(!player.is_opened())
+    {
+      fprintf(stderr, "打开失败: %s\n", url);
+      return NAN;
+    }
+    std::atomic_bool done{false};
+    std::thread quitter([&]() {
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                            std::chrono::duration<double>(duration));
+      while(!done && std::chrono::steady_clock::now() < deadline)
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      if(!done)
+      {
+        player.quit();
+      }
+    });
+    player.start();
+    done = true;
+    quitter.join();
+
+    std::string csv = csv_prefix + "_" + type_name(type) + ".csv";
+    trace.write_csv(csv);
+    std::vector<double> av_diff, actual_delay, avg_diff;
+    uint64_t dropped = 0;
+    for(const VideoSyncSample &s : trace.video())
+    {
+      if(s.dropped)
+      {
+        dropped++;
+        continue;
+      }
+      av_diff.push_back(s.av_diff);
+      actual_delay.push_back(s.actual_delay < 0 ? s.actual_delay : NAN);
+    }
+    uint64_t compensated = 0;
+    for(const AudioSyncSample &s : trace.audio())
+    {
+      avg_diff.push_back(s.avg_diff);
+      if(s.wanted_nb_samples != s.nb_samples)
+      {
+        compensated++;
+      }
+    }
+    Percentiles av = percentiles(av_diff);
+    //只统计显示晚了的帧,提前到达后等待的时间不算误差
+    Percentiles late = percentiles(actual_delay);
+    printf("{\"file\":\"%s\",\"sync\":\"%s\",\"skew\":%g,\"csv\":\"%s\",\"video_frames\":%zu,\"dropped\":%llu,"
+           "\"av_diff_ms\":%s,\"late_actual_delay_ms\":%s,\"avg_diff_ms\":%s,\"audio_frames\":%zu,"
+           "\"compensated_audio_frames\":%llu}\n",
+           url, type_name(type), skew, csv.c_str(), trace.video().size(), (unsigned long long)dropped,
+           to_json(av).c_str(), to_json(late).c_str(), to_json(percentiles(avg_diff)).c_str(), trace.audio().size(),
+           (unsigned long long)compensated);
+    fflush(stdout);
+    return av.p99;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  const char *url = "../a.flv";
+  std::vector<AV_SYNC_TYPE> types = {AV_SYNC_TYPE::AV_SYNC_AUDIO_MASTER, AV_SYNC_TYPE::AV_SYNC_VIDEO_MASTER,
+                                     AV_SYNC_TYPE::AV_SYNC_EXTERNAL_MASTER};
+  double skew = 0;
+  double duration = 30;
+  double max_p99_ms = -1;
+  std::string csv_prefix = "sync";
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--types") == 0 && i + 1 < argc)
+    {
+      types.clear();
+      for(char *tok = strtok(argv[++i], ","); tok; tok = strtok(NULL, ","))
+      {
+        if(strcmp(tok, "audio") == 0)
+        {
+          types.push_back(AV_SYNC_TYPE::AV_SYNC_AUDIO_MASTER);
+        }
+        else if(strcmp(tok, "video") == 0)
+        {
+          types.push_back(AV_SYNC_TYPE::AV_SYNC_VIDEO_MASTER);
+        }
+        else if(strcmp(tok, "external") == 0)
+        {
+          types.push_back(AV_SYNC_TYPE::AV_SYNC_EXTERNAL_MASTER);
+        }
+        else
+        {
+          fprintf(stderr, "未知的同步方式: %s\n", tok);
+          return 2;
+        }
+      }
+    }
+    else if(strcmp(argv[i], "--skew") == 0 && i + 1 < argc)
+    {
+      skew = atof(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--duration") == 0 && i + 1 < argc)
+    {
+      duration = atof(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--csv-prefix") == 0 && i + 1 < argc)
+    {
+      csv_prefix = argv[++i];
+    }
+    else if(strcmp(argv[i], "--max-p99-ms") == 0 && i + 1 < argc)
+    {
+      max_p99_ms = atof(argv[++i]);
+    }
+    else
+    {
+      url = argv[i];
+    }
+  }
+  av_log_set_level(AV_LOG_ERROR);
+
+  int status = 0;
+  for(AV_SYNC_TYPE type : types)
+  {
+    double p99 = run(url, type, skew, duration, csv_prefix);
+    if(std::isnan(p99))
+    {
+      return 1;
+    }
+    if(max_p99_ms >= 0 && p99 * 1000 > max_p99_ms)
+    {
+      fprintf(stderr, "%s为主时音视频偏差p99 %.1fms 超过了 %.1fms\n", type_name(type), p99 * 1000, max_p99_ms);
+      status = 1;
+    }
+  }
+  return status;
+}
@@ -0,0 +1,110 @@
+#include "clock.h"
+#include <cerrno>
+#include <ctime>
+#include <thread>
+
+double monotonic_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double precise_sleep_until(double target, double spin)
+{
+  double now = monotonic_now();
+  //SDL_Delay只有毫秒精度,而且经常多睡1~2ms,这里先睡到目标前一点点
+  if(target - now > spin)
+  {
+    double wake = target - spin;
+    struct timespec ts;
+    ts.tv_sec = (time_t)wake;
+    ts.tv_nsec = (long)((wake - ts.tv_sec) * 1e9);
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    {
+    }
+    now = monotonic_now();
+  }
+  //剩下不到spin秒的时间自旋,让出cpu但不进入睡眠
+  while(now < target)
+  {
+    std::this_thread::yield();
+    now = monotonic_now();
+  }
+  return now;
+}
+
+double Clock::get() const
+{
+  uint32_t seq;
+  double pts, drift, updated, speed;
+  bool is_paused;
+  do
+  {
+    seq = seq_.load(std::memory_order_acquire);
+    pts = pts_.load(std::memory_order_relaxed);
+    drift = pts_drift_.load(std::memory_order_relaxed);
+    updated = last_updated_.load(std::memory_order_relaxed);
+    speed = speed_.load(std::memory_order_relaxed);
+    is_paused = paused_.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while((seq & 1) || seq != seq_.load(std::memory_order_relaxed));
+
+  if(is_paused)
+  {
+    return pts;
+  }
+  double time = monotonic_now();
+  //变速时,距离上次设置过去的时间要按速度缩放
+  return drift + time - (time - updated) * (1.0 - speed);
+}
+
+void Clock::set_at(double pts, int serial, double time)
+{
+  write_begin();
+  store(pts, serial, time);
+  write_end();
+}
+
+void Clock::set(double pts, int serial)
+{
+  set_at(pts, serial, monotonic_now());
+}
+
+void Clock::store(double pts, int serial, double time)
+{
+  pts_.store(pts, std::memory_order_relaxed);
+  last_updated_.store(time, std::memory_order_relaxed);
+  pts_drift_.store(pts - time, std::memory_order_relaxed);
+  serial_.store(serial, std::memory_order_relaxed);
+}
+
+void Clock::set_speed(double speed)
+{
+  //改变速度前先把当前值固定下来,避免时钟跳变;新的起点和速度在同一次写入里,读者不会拿旧的drift配新的速度
+  double pts = get();
+  write_begin();
+  store(pts, serial(), monotonic_now());
+  speed_.store(speed, std::memory_order_relaxed);
+  write_end();
+}
+
+void Clock::set_paused(bool paused)
+{
+  //暂停时固定在当前值,恢复时从当前时间重新开始走
+  double pts = paused ? get() : pts_.load(std::memory_order_relaxed);
+  write_begin();
+  store(pts, serial(), monotonic_now());
+  paused_.store(paused, std::memory_order_relaxed);
+  write_end();
+}
+
+void Clock::sync_to_slave(const Clock &slave, double threshold)
+{
+  double clock = get();
+  double slave_clock = slave.get();
+  if(!std::isnan(slave_clock) && (std::isnan(clock) || std::fabs(clock - slave_clock) > threshold))
+  {
+    set(slave_clock, slave.serial());
+  }
+}
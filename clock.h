@@ -0,0 +1,47 @@
+#pragma once
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+//单调时钟的当前时间(秒),不受NTP和手动改系统时间的影响
+double monotonic_now();
+
+//混合睡眠:先用clock_nanosleep睡到目标时间前spin秒,剩下的时间自旋等待,返回实际醒来的时间
+double precise_sleep_until(double target, double spin = 0.002);
+
+/*
+ * 播放时钟,参考ffplay的Clock
+ * 记录 pts_drift = pts - 设置时的系统时间, 读取时加上当前系统时间就是此刻的播放位置
+ * 支持暂停、变速和serial(seek之后serial变化,旧的时钟值作废)
+ * 只允许一个线程写,任意线程读,用seqlock保证读到的字段是同一次写入的
+ */
+class Clock {
+public:
+  //当前时钟值,还没有被设置过时返回NAN
+  double get() const;
+  void set(double pts, int serial);
+  void set_at(double pts, int serial, double time);
+  void set_speed(double speed);
+  void set_paused(bool paused);
+  //本时钟和slave差距太大(或者还没设置过)时直接跟随slave,外部时钟用它来跟随音频/视频时钟
+  void sync_to_slave(const Clock &slave, double threshold);
+
+  int serial() const { return serial_.load(std::memory_order_relaxed); }
+  double speed() const { return speed_.load(std::memory_order_relaxed); }
+  double last_updated() const { return last_updated_.load(std::memory_order_relaxed); }
+  bool paused() const { return paused_.load(std::memory_order_relaxed); }
+
+private:
+  void write_begin() { seq_.fetch_add(1, std::memory_order_relaxed); std::atomic_thread_fence(std::memory_order_release); }
+  void write_end() { seq_.fetch_add(1, std::memory_order_release); }
+  //写入一次设置的各个字段,调用者负责write_begin/write_end
+  void store(double pts, int serial, double time);
+
+  std::atomic<uint32_t> seq_{0};
+  std::atomic<double> pts_{NAN};
+  std::atomic<double> pts_drift_{NAN};
+  std::atomic<double> last_updated_{0.0};
+  std::atomic<double> speed_{1.0};
+  std::atomic<int> serial_{-1};
+  std::atomic_bool paused_{false};
+};
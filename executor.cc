@@ -0,0 +1,225 @@
+#include "executor.h"
+#include "clock.h"
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+  //IDLE的任务从IDLE_BACKOFF_MIN秒开始每次退避时间翻倍,最多IDLE_BACKOFF_MAX秒
+  const double IDLE_BACKOFF_MIN = 0.0005;
+  const double IDLE_BACKOFF_MAX = 0.008;
+  const int IDLE_BACKOFF_STEPS = 4;
+  //当前线程所属的执行器和它在执行器里的下标,任务里提交的新任务直接放进本线程的队列
+  thread_local Executor *current_executor = nullptr;
+  thread_local int current_worker = -1;
+  std::atomic<unsigned> next_worker{0};
+}
+
+Executor::Executor(int threads)
+{
+  if(threads <= 0)
+  {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  //先把所有队列建好,工作线程启动后会去偷别的线程的任务
+  for(int i = 0; i < threads; i++)
+  {
+    workers_.emplace_back(new Worker());
+  }
+  for(int i = 0; i < threads; i++)
+  {
+    workers_[i]->thread = std::thread(&Executor::run, this, i);
+  }
+}
+
+Executor::~Executor()
+{
+  {
+    std::lock_guard<std::mutex> lock(park_mutex_);
+    stop_ = true;
+  }
+  park_cv_.notify_all();
+  for(auto &w : workers_)
+  {
+    w->thread.join();
+  }
+  //还没结束的任务直接丢掉,它们引用的播放器应该已经先结束了
+  for(auto &w : workers_)
+  {
+    for(Task *t : w->tasks)
+    {
+      delete t;
+    }
+  }
+  for(auto &t : timers_)
+  {
+    delete t.second;
+  }
+}
+
+void Executor::submit(std::function<TaskStatus()> step, std::function<void()> done)
+{
+  Task *task = new Task();
+  task->step = std::move(step);
+  task->done = std::move(done);
+  int index = current_executor == this ? current_worker : (int)(next_worker++ % workers_.size());
+  push(index, task);
+  wake_one();
+}
+
+ExecutorStats Executor::stats() const
+{
+  ExecutorStats st;
+  st.steps = steps_;
+  st.steals = steals_;
+  st.idle_steps = idle_steps_;
+  return st;
+}
+
+void Executor::push(int index, Task *task)
+{
+  Worker &w = *workers_[index];
+  std::lock_guard<std::mutex> lock(w.mutex);
+  w.tasks.push_back(task);
+  queued_++;
+}
+
+Executor::Task *Executor::pop(int index)
+{
+  Worker &w = *workers_[index];
+  std::lock_guard<std::mutex> lock(w.mutex);
+  if(w.tasks.empty())
+  {
+    return nullptr;
+  }
+  Task *task = w.tasks.front();
+  w.tasks.pop_front();
+  queued_--;
+  return task;
+}
+
+Executor::Task *Executor::steal(int index)
+{
+  int n = (int)workers_.size();
+  for(int i = 1; i < n; i++)
+  {
+    Worker &w = *workers_[(index + i) % n];
+    std::lock_guard<std::mutex> lock(w.mutex);
+    if(!w.tasks.empty())
+    {
+      //从队尾偷,和主人从队首取互不干扰
+      Task *task = w.tasks.back();
+      w.tasks.pop_back();
+      queued_--;
+      steals_++;
+      return task;
+    }
+  }
+  return nullptr;
+}
+
+double Executor::release_timers(int index)
+{
+  std::vector<Task *> due;
+  double next = 0;
+  {
+    std::lock_guard<std::mutex> lock(park_mutex_);
+    double now = monotonic_now();
+    while(!timers_.empty() && timers_.begin()->first <= now)
+    {
+      due.push_back(timers_.begin()->second);
+      timers_.erase(timers_.begin());
+    }
+    if(!timers_.empty())
+    {
+      next = timers_.begin()->first;
+    }
+  }
+  for(size_t i = 0; i < due.size(); i++)
+  {
+    push(index, due[i]);
+    //第一个留给自己,多出来的叫醒别的线程来偷
+    if(i > 0)
+    {
+      wake_one();
+    }
+  }
+  return next;
+}
+
+void Executor::wake_one()
+{
+  std::lock_guard<std::mutex> lock(park_mutex_);
+  if(parked_ > 0)
+  {
+    park_cv_.notify_one();
+  }
+}
+
+void Executor::run(int index)
+{
+  current_executor = this;
+  current_worker = index;
+  while(!stop_)
+  {
+    double next_timer = release_timers(index);
+    Task *task = pop(index);
+    if(!task)
+    {
+      task = steal(index);
+    }
+    if(!task)
+    {
+      //没有任务可做:睡到下一个退避任务到期,或者有新任务提交
+      std::unique_lock<std::mutex> lock(park_mutex_);
+      if(stop_ || queued_ > 0)
+      {
+        continue;
+      }
+      if(!timers_.empty())
+      {
+        next_timer = next_timer > 0 ? std::min(next_timer, timers_.begin()->first) : timers_.begin()->first;
+      }
+      parked_++;
+      if(next_timer > 0)
+      {
+        double wait = next_timer - monotonic_now();
+        if(wait > 0)
+        {
+          park_cv_.wait_for(lock, std::chrono::duration<double>(wait));
+        }
+      }
+      else
+      {
+        park_cv_.wait(lock);
+      }
+      parked_--;
+      continue;
+    }
+
+    TaskStatus status = task->step();
+    steps_++;
+    if(status == TaskStatus::RUNNING)
+    {
+      //排到本线程队尾,和同一线程上的其它任务轮流执行
+      task->idle_count = 0;
+      push(index, task);
+    }
+    else if(status == TaskStatus::IDLE)
+    {
+      idle_steps_++;
+      double delay = std::min(IDLE_BACKOFF_MIN * (1 << task->idle_count), IDLE_BACKOFF_MAX);
+      task->idle_count = std::min(task->idle_count + 1, IDLE_BACKOFF_STEPS);
+      std::lock_guard<std::mutex> lock(park_mutex_);
+      timers_.emplace(monotonic_now() + delay, task);
+    }
+    else
+    {
+      if(task->done)
+      {
+        task->done();
+      }
+      delete task;
+    }
+  }
+}
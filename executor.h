@@ -0,0 +1,86 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//任务每执行一步之后的状态
+enum class TaskStatus
+{
+  RUNNING,//做了一些工作,还有事情要做,排到队尾马上再执行
+  IDLE,//输入为空或者输出已满,退避一段时间后再执行
+  DONE,//任务结束
+};
+
+//执行器的运行统计
+struct ExecutorStats
+{
+  uint64_t steps{0};
+  uint64_t steals{0};
+  uint64_t idle_steps{0};
+};
+
+/*
+ * 多个播放器共享的work-stealing执行器
+ * 每个播放器不再为读包、解码、格式转换各开一个线程,而是把它们写成一步一步执行的任务,所有任务跑在固定数量的工作线程上
+ * 任务每一步只处理有限的一小批数据就返回,RUNNING的任务排到本线程队尾,这样同一个线程上的各个播放器轮流执行,互相公平
+ * 每个工作线程有自己的队列,从队首取任务;自己的队列空了就从别的线程的队尾偷任务
+ * IDLE的任务不占用工作线程,按指数退避放进定时队列,到期后重新排队
+ * 同一个任务任何时刻只在一个线程上执行,两次执行之间经过队列的锁建立了happens-before关系,
+ * 所以任务内部的单生产者单消费者队列在执行器上照样成立
+ */
+class Executor {
+public:
+  //threads为0时按cpu核数
+  explicit Executor(int threads = 0);
+  ~Executor();
+  Executor(const Executor &) = delete;
+  Executor &operator=(const Executor &) = delete;
+
+  //提交任务,step返回DONE后在工作线程里调用done
+  void submit(std::function<TaskStatus()> step, std::function<void()> done = nullptr);
+  int threads() const { return (int)workers_.size(); }
+  ExecutorStats stats() const;
+
+private:
+  struct Task
+  {
+    std::function<TaskStatus()> step;
+    std::function<void()> done;
+    //连续IDLE的次数,决定退避时间
+    int idle_count{0};
+  };
+  struct Worker
+  {
+    std::mutex mutex;
+    std::deque<Task *> tasks;
+    std::thread thread;
+  };
+
+  void run(int index);
+  void push(int index, Task *task);
+  Task *pop(int index);
+  Task *steal(int index);
+  //把到期的退避任务放回队列,返回下一个任务到期的时间(没有时为0)
+  double release_timers(int index);
+  void wake_one();
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  //排队中(不含退避中)的任务数,工作线程没事做时据此决定是否睡眠
+  std::atomic<int64_t> queued_{0};
+  std::atomic_bool stop_{false};
+  //睡眠的工作线程和退避中的任务
+  std::mutex park_mutex_;
+  std::condition_variable park_cv_;
+  int parked_{0};
+  std::multimap<double, Task *> timers_;
+  std::atomic<uint64_t> steps_{0};
+  std::atomic<uint64_t> steals_{0};
+  std::atomic<uint64_t> idle_steps_{0};
+};
@@ -0,0 +1,463 @@
+#include "gop_cache.h"
+#include "clock.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace
+{
+  //打开第二份文件时只要让demuxer把流建出来,解码参数用播放器完整探测过的
+  const int64_t GOP_PROBESIZE = 32 * 1024;
+  const int64_t GOP_ANALYZEDURATION = 100000;
+  //一段最多占内存上限的1/GOP_SHARE,当前正在看的一段和正在解码的一段加起来不超过上限
+  const size_t GOP_SHARE = 2;
+  //排队等待后台解码的请求上限,来回拖动时旧的请求已经没用了
+  const size_t MAX_PREFETCH_REQUESTS = 2;
+  //pts比较的容差,也用来定位上一个GOP的最后一帧(比关键帧早一点点)
+  const double PTS_EPSILON = 1e-6;
+
+  size_t frame_bytes(const AVFrame *frame)
+  {
+    size_t bytes = 0;
+    for(int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++)
+    {
+      bytes += frame->buf[i]->size;
+    }
+    return bytes;
+  }
+}
+
+GopCache::GopCache(const char *url, const AVCodec *codec, const AVCodecParameters *par, int lowres, int threads,
+                   const KeyframeIndex *index, size_t max_bytes, bool mmap_io)
+  : index_(index), max_bytes_(max_bytes)
+{
+  if(mmap_io && io_.open(url))
+  {
+    fmt_ = avformat_alloc_context();
+    fmt_->pb = io_.context();
+  }
+  if(!fmt_)
+  {
+    fmt_ = avformat_alloc_context();
+  }
+  //析构时正在解码的GOP立刻中止
+  fmt_->interrupt_callback.callback = interrupt_callback;
+  fmt_->interrupt_callback.opaque = this;
+  AVDictionary *format_opts = NULL;
+  av_dict_set_int(&format_opts, "probesize", GOP_PROBESIZE, 0);
+  av_dict_set_int(&format_opts, "analyzeduration", GOP_ANALYZEDURATION, 0);
+  int ret = avformat_open_input(&fmt_, url, NULL, &format_opts);
+  av_dict_free(&format_opts);
+  if(ret != 0)
+  {
+    std::cerr << "GOP缓存打开文件失败:" << url << std::endl;
+    return;
+  }
+  if(avformat_find_stream_info(fmt_, NULL) >= 0)
+  {
+    video_index_ = av_find_best_stream(fmt_, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+  }
+  if(video_index_ < 0)
+  {
+    std::cerr << "GOP缓存找不到视频流" << std::endl;
+    return;
+  }
+  for(unsigned int i = 0; i < fmt_->nb_streams; i++)
+  {
+    if((int)i != video_index_)
+    {
+      fmt_->streams[i]->discard = AVDISCARD_ALL;
+    }
+  }
+  time_base_ = fmt_->streams[video_index_]->time_base;
+
+  dec_ = avcodec_alloc_context3(codec);
+  avcodec_parameters_to_context(dec_, par);
+  dec_->lowres = lowres;
+  //一次解码一整个GOP,吞吐量比延迟重要,帧线程和片线程都可以用
+  dec_->thread_count = threads;
+  dec_->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  if(avcodec_open2(dec_, codec, NULL) < 0)
+  {
+    std::cerr << "GOP缓存打开解码器失败" << std::endl;
+    return;
+  }
+  pkt_ = av_packet_alloc();
+  frame_ = av_frame_alloc();
+  opened_ = true;
+  worker_ = std::thread(&GopCache::run, this);
+}
+
+GopCache::~GopCache()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if(worker_.joinable())
+  {
+    worker_.join();
+  }
+  for(Gop &gop : gops_)
+  {
+    free_gop(gop);
+  }
+  av_frame_free(&frame_);
+  av_packet_free(&pkt_);
+  avcodec_free_context(&dec_);
+  avformat_close_input(&fmt_);
+}
+
+int GopCache::interrupt_callback(void *opaque)
+{
+  return static_cast<GopCache *>(opaque)->stop_;
+}
+
+bool GopCache::frame_at(double pts, int offset, Frame &out)
+{
+  if(!opened_ || std::isnan(pts))
+  {
+    return false;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  GopList::iterator it = find(pts, true);
+  if(it == gops_.end())
+  {
+    stats_.misses++;
+    lock.unlock();
+    if(!decode(pts, false))
+    {
+      return false;
+    }
+    lock.lock();
+    it = find(pts, true);
+    if(it == gops_.end())
+    {
+      return false;
+    }
+  }
+  else
+  {
+    stats_.hits++;
+  }
+  const std::vector<Frame> &frames = it->frames;
+  //显示时间不晚于pts的最后一帧,pts在GOP的第一帧之前时取第一帧
+  auto upper = std::upper_bound(frames.begin(), frames.end(), pts + PTS_EPSILON,
+                                [](double t, const Frame &f) { return t < f.pts; });
+  int i = std::max((int)(upper - frames.begin()) - 1, 0) + offset;
+  //跨过GOP边界:上一个GOP的最后一帧就在关键帧之前一点点,下一个GOP的第一帧就是下一个关键帧
+  if(i < 0 && !std::isinf(it->start))
+  {
+    double prev = it->start - PTS_EPSILON;
+    lock.unlock();
+    return frame_at(prev, i + 1, out);
+  }
+  if(i >= (int)frames.size() && !std::isinf(it->end))
+  {
+    double next = it->end;
+    int left = i - (int)frames.size();
+    lock.unlock();
+    return frame_at(next, left, out);
+  }
+  i = std::min(std::max(i, 0), (int)frames.size() - 1);
+  const Frame &f = frames[i];
+  if(av_frame_ref(out.frame, f.frame) < 0)
+  {
+    return false;
+  }
+  out.pts = f.pts;
+  out.data_bytes = f.data_bytes;
+  //往哪个方向移动就提前解码那一边的相邻GOP
+  double start = it->start;
+  double end = it->end;
+  lock.unlock();
+  if(offset < 0 && !std::isinf(start))
+  {
+    prefetch(start - PTS_EPSILON);
+  }
+  else if(offset > 0 && !std::isinf(end))
+  {
+    prefetch(end);
+  }
+  return true;
+}
+
+void GopCache::prefetch(double pts)
+{
+  if(!opened_)
+  {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(find(pts, false) != gops_.end() || std::find(requests_.begin(), requests_.end(), pts) != requests_.end())
+    {
+      return;
+    }
+    requests_.push_back(pts);
+    while(requests_.size() > MAX_PREFETCH_REQUESTS)
+    {
+      requests_.pop_front();
+    }
+  }
+  cv_.notify_one();
+}
+
+GopCacheStats GopCache::stats() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+GopCache::GopList::iterator GopCache::find(double pts, bool touch)
+{
+  for(GopList::iterator it = gops_.begin(); it != gops_.end(); ++it)
+  {
+    if(it->start <= pts && pts < it->end)
+    {
+      if(touch && it != gops_.begin())
+      {
+        gops_.splice(gops_.begin(), gops_, it);
+      }
+      return it;
+    }
+  }
+  return gops_.end();
+}
+
+bool GopCache::decode(double pts, bool background)
+{
+  std::lock_guard<std::mutex> decode_lock(decode_mutex_);
+  {
+    //等解码器的时候另一个线程可能已经把它解出来了
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(find(pts, false) != gops_.end())
+    {
+      return true;
+    }
+  }
+  {
+    //先给正在解码的这一段腾出位置,解码过程中缓存加上它也不会超过上限
+    std::lock_guard<std::mutex> lock(mutex_);
+    evict(max_bytes_ - segment_bytes());
+  }
+  Gop gop;
+  double begin = monotonic_now();
+  bool ok = decode_gop(pts, gop);
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.decode_seconds += monotonic_now() - begin;
+  if(!ok)
+  {
+    free_gop(gop);
+    return false;
+  }
+  stats_.gops_decoded++;
+  if(background)
+  {
+    stats_.gops_prefetched++;
+  }
+  //目标在第一个关键帧之前时,解出来的是已经缓存的第一个GOP,只要把它的范围扩展到文件开头
+  GopList::iterator same = find(gop.frames.front().pts, false);
+  if(same != gops_.end())
+  {
+    same->start = std::min(same->start, gop.start);
+    free_gop(gop);
+    return true;
+  }
+  insert(std::move(gop));
+  return true;
+}
+
+bool GopCache::decode_gop(double pts, Gop &gop)
+{
+  int64_t target = (int64_t)(pts * AV_TIME_BASE);
+  int ret = -1;
+  if(index_)
+  {
+    const KeyframeEntry *e = index_->find(target);
+    if(e)
+    {
+      ret = av_seek_frame(fmt_, -1, e->pos, AVSEEK_FLAG_BYTE);
+    }
+  }
+  if(ret < 0)
+  {
+    ret = avformat_seek_file(fmt_, -1, INT64_MIN, target, target, 0);
+  }
+  if(ret < 0)
+  {
+    return false;
+  }
+  avcodec_flush_buffers(dec_);
+  gop.start = NAN;
+  gop.end = INFINITY;
+  //包含pts的那一段已经完整了(解码器吐出了不早于end的帧),后面的不用再解码
+  bool cut = false;
+  while(!cut && !stop_ && av_read_frame(fmt_, pkt_) >= 0)
+  {
+    if(pkt_->stream_index != video_index_)
+    {
+      av_packet_unref(pkt_);
+      continue;
+    }
+    int64_t ts = pkt_->pts != AV_NOPTS_VALUE ? pkt_->pts : pkt_->dts;
+    double t = ts == AV_NOPTS_VALUE ? NAN : ts * av_q2d(time_base_);
+    //已经找到下一个关键帧之后,再遇到的关键帧都不用管;没有时间戳的关键帧没法定位,当普通的包送
+    if((pkt_->flags & AV_PKT_FLAG_KEY) && std::isinf(gop.end) && !std::isnan(t))
+    {
+      if(!std::isnan(gop.start) && !(t <= pts))
+      {
+        //下一个关键帧,这个GOP到此为止;但open GOP里显示时间在它之前的B帧解码顺序排在它后面,
+        //它们参考的是这个GOP的帧,所以接着送包,直到解码器吐出不早于它的帧
+        gop.end = t;
+      }
+      else
+      {
+        if(!std::isnan(gop.start))
+        {
+          //seek落在了更早的关键帧上(文件自带的seek信息不准),前面解出来的不要了,从这个关键帧重新开始
+          free_gop(gop);
+          avcodec_flush_buffers(dec_);
+        }
+        gop.start = t;
+      }
+    }
+    //关键帧之前的包解码器反正也会跳过,不用送
+    if(std::isnan(gop.start))
+    {
+      av_packet_unref(pkt_);
+      continue;
+    }
+    ret = avcodec_send_packet(dec_, pkt_);
+    av_packet_unref(pkt_);
+    if(ret < 0 && ret != AVERROR(EAGAIN))
+    {
+      std::cerr << "GOP缓存解码失败:" << av_err2str(ret) << std::endl;
+      return false;
+    }
+    cut = receive_frames(pts, gop);
+  }
+  if(stop_ || std::isnan(gop.start))
+  {
+    return false;
+  }
+  //冲出解码器里重排延迟的帧;下一次seek之后的flush会把解码器恢复
+  if(!cut)
+  {
+    avcodec_send_packet(dec_, NULL);
+    receive_frames(pts, gop);
+  }
+  if(gop.frames.empty())
+  {
+    return false;
+  }
+  //seek落在了目标之后,说明目标在第一个关键帧之前,这就是文件的第一个GOP
+  if(gop.start > pts)
+  {
+    gop.start = -INFINITY;
+  }
+  std::sort(gop.frames.begin(), gop.frames.end(), [](const Frame &a, const Frame &b) { return a.pts < b.pts; });
+  return true;
+}
+
+bool GopCache::receive_frames(double pts, Gop &gop)
+{
+  while(avcodec_receive_frame(dec_, frame_) >= 0)
+  {
+    double t = frame_pts(frame_, time_base_);
+    //从关键帧解起时,open GOP开头那几个依赖上一个GOP的B帧是花的,它们属于上一个GOP,不缓存
+    if(std::isnan(t) || t < gop.start)
+    {
+      av_frame_unref(frame_);
+      continue;
+    }
+    //解码器按显示顺序输出,到了下一个关键帧,这个GOP的帧都已经出来了
+    if(t >= gop.end)
+    {
+      av_frame_unref(frame_);
+      return true;
+    }
+    //这一段放不下了就从这一帧切开:目标在前面就到此为止,否则这一段不要了,从这一帧开始下一段
+    size_t bytes = frame_bytes(frame_);
+    if(!gop.frames.empty() && gop.bytes + bytes > segment_bytes())
+    {
+      if(pts < t)
+      {
+        gop.end = t;
+        av_frame_unref(frame_);
+        return true;
+      }
+      free_gop(gop);
+      gop.start = t;
+    }
+    Frame f;
+    f.frame = av_frame_alloc();
+    av_frame_move_ref(f.frame, frame_);
+    f.pts = t;
+    f.data_bytes = (int)bytes;
+    gop.bytes += f.data_bytes;
+    gop.frames.push_back(f);
+  }
+  return false;
+}
+
+size_t GopCache::segment_bytes() const
+{
+  return max_bytes_ / GOP_SHARE;
+}
+
+void GopCache::insert(Gop &&gop)
+{
+  stats_.gops++;
+  stats_.frames += gop.frames.size();
+  stats_.bytes += gop.bytes;
+  stats_.peak_bytes = std::max(stats_.peak_bytes, stats_.bytes);
+  gops_.push_front(std::move(gop));
+  evict(max_bytes_);
+}
+
+void GopCache::evict(size_t limit)
+{
+  //至少留一段:刚放进去的,或者解码之前正在看的那一段
+  while(stats_.bytes > limit && gops_.size() > 1)
+  {
+    Gop &old = gops_.back();
+    stats_.gops--;
+    stats_.frames -= old.frames.size();
+    stats_.bytes -= old.bytes;
+    stats_.evictions++;
+    free_gop(old);
+    gops_.pop_back();
+  }
+}
+
+void GopCache::free_gop(Gop &gop)
+{
+  for(Frame &f : gop.frames)
+  {
+    av_frame_free(&f.frame);
+  }
+  gop.frames.clear();
+  gop.bytes = 0;
+}
+
+void GopCache::run()
+{
+  while(true)
+  {
+    double pts;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return stop_ || !requests_.empty(); });
+      if(stop_)
+      {
+        return;
+      }
+      //最新的请求最要紧
+      pts = requests_.back();
+      requests_.pop_back();
+    }
+    decode(pts, true);
+  }
+}
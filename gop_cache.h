@@ -0,0 +1,118 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "media_frame.h"
+#include "keyframe_index.h"
+#include "mmap_io.h"
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+//GOP缓存的命中率和内存占用
+struct GopCacheStats
+{
+  //frame_at在缓存里找到的次数,以及需要当场解码的次数
+  uint64_t hits{0};
+  uint64_t misses{0};
+  //解码过的GOP数,其中在后台提前解码的个数,以及超过内存上限被淘汰的个数
+  uint64_t gops_decoded{0};
+  uint64_t gops_prefetched{0};
+  uint64_t evictions{0};
+  //当前缓存的GOP数、帧数、帧数据占用的内存(字节)和内存的最高水位
+  uint64_t gops{0};
+  uint64_t frames{0};
+  uint64_t bytes{0};
+  uint64_t peak_bytes{0};
+  //解码GOP花掉的时间(秒)
+  double decode_seconds{0};
+};
+
+/*
+ * 解码后GOP的LRU缓存,用于逐帧步进、倒放和来回拖动
+ * 播放流水线只能从关键帧往后解码,往回退一帧就要从关键帧重新解一遍;这里以GOP为单位把解码出来的帧整组留下,
+ * 按pts查找,同一个GOP里前后移动不用再解码
+ * 和缩略图线程一样单独打开一份文件和一个解码器,不影响播放流水线;每次移动之后后台线程提前解码移动方向上的下一个GOP,
+ * 倒放时前一个GOP总是在当前GOP放完之前就解好了
+ * 内存按帧数据的实际大小计算,超过上限时淘汰最久没有访问的GOP;一个GOP超过上限的一半时切成几段分别缓存,
+ * 每段都从关键帧解起,只留下这一段的帧;解码之前先腾出一段的位置,缓存加上正在解码的一段不会超过上限
+ */
+class GopCache {
+public:
+  //codec和par来自播放器完整探测过的视频流,lowres和播放用的解码器一致;index不为空时按关键帧索引的字节位置seek
+  GopCache(const char *url, const AVCodec *codec, const AVCodecParameters *par, int lowres, int threads,
+           const KeyframeIndex *index, size_t max_bytes, bool mmap_io);
+  ~GopCache();
+  GopCache(const GopCache &) = delete;
+  GopCache &operator=(const GopCache &) = delete;
+
+  bool is_opened() const { return opened_; }
+  //找到显示时间不晚于pts的那一帧,再往后(offset>0)或往前(offset<0)移动offset帧,跨过GOP边界时解码相邻的GOP
+  //out.frame由调用者分配,成功时引用那一帧的数据(用完av_frame_unref),并填好pts和data_bytes
+  //到了文件开头或者末尾就停在第一帧或者最后一帧
+  bool frame_at(double pts, int offset, Frame &out);
+  //在后台解码包含pts的GOP
+  void prefetch(double pts);
+  GopCacheStats stats() const;
+
+private:
+  struct Gop
+  {
+    //[start, end)是这个GOP的关键帧和下一个关键帧的pts(秒);文件的第一个GOP start为-INFINITY,最后一个end为INFINITY
+    //GOP太大被切开时是这一段第一帧和下一段第一帧的pts
+    double start;
+    double end;
+    //按pts升序
+    std::vector<Frame> frames;
+    size_t bytes{0};
+  };
+  //最前面是最近访问的;能放下的GOP不多,直接顺序查找
+  using GopList = std::list<Gop>;
+
+  static int interrupt_callback(void *opaque);
+  //包含pts的GOP,调用时持有mutex_;touch时移到最前面
+  GopList::iterator find(double pts, bool touch);
+  //解码包含pts的GOP放进缓存,已经有了直接返回true
+  bool decode(double pts, bool background);
+  //seek到pts之前的关键帧,一直解码到吐出下一个关键帧那一帧为止(open GOP排在它后面的B帧也要),GOP太大时只留下包含pts的一段
+  bool decode_gop(double pts, Gop &gop);
+  //收下解码器吐出来的帧,包含pts的一段已经切出来时返回true
+  bool receive_frames(double pts, Gop &gop);
+  //一段最多占用的内存
+  size_t segment_bytes() const;
+  //放进缓存并按内存上限淘汰,调用时持有mutex_
+  void insert(Gop &&gop);
+  //从最久没有访问的开始淘汰,直到不超过limit,调用时持有mutex_
+  void evict(size_t limit);
+  static void free_gop(Gop &gop);
+  void run();
+
+  MmapIO io_;
+  AVFormatContext *fmt_{nullptr};
+  AVCodecContext *dec_{nullptr};
+  AVPacket *pkt_{nullptr};
+  AVFrame *frame_{nullptr};
+  int video_index_{-1};
+  AVRational time_base_{0, 1};
+  const KeyframeIndex *index_;
+  size_t max_bytes_;
+  bool opened_{false};
+
+  mutable std::mutex mutex_;
+  GopList gops_;
+  GopCacheStats stats_;
+  //同一时间只有一个线程使用demuxer和解码器
+  std::mutex decode_mutex_;
+  //后台解码的请求,只保留最近的几个
+  std::condition_variable cv_;
+  std::deque<double> requests_;
+  std::atomic_bool stop_{false};
+  std::thread worker_;
+};
@@ -0,0 +1,173 @@
+#include "keyframe_index.h"
+#include "sidecar.h"
+extern "C" {
+#include <libavformat/avformat.h>
+}
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+  const char INDEX_MAGIC[8] = {'K', 'F', 'I', 'D', 'X', 0, 0, 0};
+  const uint32_t INDEX_VERSION = 1;
+
+  struct KeyframeIndexHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    int64_t file_size;
+    int64_t mtime_ns;
+  };
+}
+
+KeyframeIndex::~KeyframeIndex()
+{
+  if(map_)
+  {
+    munmap(map_, map_size_);
+  }
+}
+
+std::string KeyframeIndex::path_for(const std::string &media_path, const std::string &cache_dir)
+{
+  return sidecar_path(media_path, cache_dir, ".kfidx");
+}
+
+bool KeyframeIndex::load(const std::string &index_path, const std::string &media_path)
+{
+  int64_t size, mtime;
+  if(!file_identity(media_path, size, mtime))
+  {
+    return false;
+  }
+  int fd = open(index_path.c_str(), O_RDONLY);
+  if(fd < 0)
+  {
+    return false;
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(KeyframeIndexHeader))
+  {
+    close(fd);
+    return false;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED)
+  {
+    return false;
+  }
+  const KeyframeIndexHeader *header = (const KeyframeIndexHeader *)map;
+  bool valid = memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 && header->version == INDEX_VERSION &&
+               header->file_size == size && header->mtime_ns == mtime &&
+               (size_t)st.st_size == sizeof(KeyframeIndexHeader) + header->count * sizeof(KeyframeEntry);
+  if(!valid)
+  {
+    munmap(map, st.st_size);
+    return false;
+  }
+  map_ = map;
+  map_size_ = st.st_size;
+  entries_ = (const KeyframeEntry *)(header + 1);
+  count_ = header->count;
+  return true;
+}
+
+bool KeyframeIndex::build(const std::string &media_path, const std::string &index_path, const std::atomic_bool &cancel)
+{
+  int64_t size, mtime;
+  if(!file_identity(media_path, size, mtime))
+  {
+    return false;
+  }
+  AVFormatContext *fmt = NULL;
+  if(avformat_open_input(&fmt, media_path.c_str(), NULL, NULL) != 0)
+  {
+    return false;
+  }
+  if(avformat_find_stream_info(fmt, NULL) < 0)
+  {
+    avformat_close_input(&fmt);
+    return false;
+  }
+  int video = av_find_best_stream(fmt, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+  if(video < 0)
+  {
+    avformat_close_input(&fmt);
+    return false;
+  }
+  //只关心视频包的位置,其它流不用交给我们
+  for(unsigned int i = 0; i < fmt->nb_streams; i++)
+  {
+    if((int)i != video)
+    {
+      fmt->streams[i]->discard = AVDISCARD_ALL;
+    }
+  }
+  AVRational time_base = fmt->streams[video]->time_base;
+  std::vector<KeyframeEntry> entries;
+  AVPacket *pkt = av_packet_alloc();
+  while(!cancel && av_read_frame(fmt, pkt) >= 0)
+  {
+    if(pkt->stream_index == video && (pkt->flags & AV_PKT_FLAG_KEY) && pkt->pos >= 0)
+    {
+      int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+      if(ts != AV_NOPTS_VALUE)
+      {
+        entries.push_back({av_rescale_q(ts, time_base, AVRational{1, AV_TIME_BASE}), pkt->pos});
+      }
+    }
+    av_packet_unref(pkt);
+  }
+  av_packet_free(&pkt);
+  avformat_close_input(&fmt);
+  if(cancel || entries.empty())
+  {
+    return false;
+  }
+  std::sort(entries.begin(), entries.end(), [](const KeyframeEntry &a, const KeyframeEntry &b) { return a.pts < b.pts; });
+
+  KeyframeIndexHeader header = {};
+  memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  header.version = INDEX_VERSION;
+  header.count = (uint32_t)entries.size();
+  header.file_size = size;
+  header.mtime_ns = mtime;
+  //先写临时文件再rename,别的进程同时打开时不会读到写了一半的索引
+  std::string tmp = index_path + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "wb");
+  if(!f)
+  {
+    std::cerr << "创建关键帧索引失败:" << tmp << std::endl;
+    return false;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+            fwrite(entries.data(), sizeof(KeyframeEntry), entries.size(), f) == entries.size();
+  ok = fclose(f) == 0 && ok;
+  if(!ok || rename(tmp.c_str(), index_path.c_str()) != 0)
+  {
+    std::cerr << "写入关键帧索引失败:" << index_path << std::endl;
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+const KeyframeEntry *KeyframeIndex::find(int64_t target) const
+{
+  if(count_ == 0)
+  {
+    return NULL;
+  }
+  const KeyframeEntry *it = std::upper_bound(begin(), end(), target,
+                                             [](int64_t t, const KeyframeEntry &e) { return t < e.pts; });
+  return it == begin() ? it : it - 1;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//索引里的一项:视频关键帧的pts(AV_TIME_BASE为单位,和seek用同一个时间轴)和它在文件里的字节位置
+struct KeyframeEntry
+{
+  int64_t pts;
+  int64_t pos;
+};
+
+/*
+ * 持久化的关键帧索引
+ * flv之类的文件经常没有可靠的seek信息,第一次打开时在后台扫一遍视频包把关键帧记下来,
+ * 写到媒体文件旁边(或者指定的缓存目录)的sidecar文件里,之后再打开直接mmap,seek时二分查找再按字节位置跳转
+ * 文件格式: KeyframeIndexHeader + count个KeyframeEntry,按pts升序,本机字节序
+ * 头部记录了媒体文件的大小和修改时间,对不上说明文件变了,索引作废
+ */
+class KeyframeIndex {
+public:
+  KeyframeIndex() = default;
+  ~KeyframeIndex();
+  KeyframeIndex(const KeyframeIndex &) = delete;
+  KeyframeIndex &operator=(const KeyframeIndex &) = delete;
+
+  //mmap索引文件并校验,失败返回false
+  bool load(const std::string &index_path, const std::string &media_path);
+  //扫描媒体文件的视频关键帧并写入索引文件,cancel变为true时提前放弃
+  static bool build(const std::string &media_path, const std::string &index_path, const std::atomic_bool &cancel);
+  //索引文件的路径,cache_dir为空时放在媒体文件旁边;不是本地文件时返回空字符串
+  static std::string path_for(const std::string &media_path, const std::string &cache_dir);
+
+  //pts不大于target的最后一个关键帧,没有时返回第一个;索引为空返回NULL
+  const KeyframeEntry *find(int64_t target) const;
+  const KeyframeEntry *begin() const { return entries_; }
+  const KeyframeEntry *end() const { return entries_ + count_; }
+  size_t size() const { return count_; }
+
+private:
+  void *map_{nullptr};
+  size_t map_size_{0};
+  const KeyframeEntry *entries_{nullptr};
+  size_t count_{0};
+};
@@ -1,9 +1,80 @@
 #include "player.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 using namespace std;
 
 
+//用法: player [--live] [--live-latency S] [--mmap-io] [--output-size WxH] [--record out.mkv]
+//              [--thumbnails N] [--thumb-width W] [--columns C] [--threads T] [--sprite out.jpg] [--map out.vtt] [file]
+//--live按直播流播放,缓冲保持在--live-latency秒(默认0.5)左右;--mmap-io本地文件通过mmap读取
+//--output-size WxH按窗口大小缩放一次再显示,0表示按比例;--record边播边录到指定文件
+//带--thumbnails时不播放,只生成N张缩略图拼成的雪碧图和对应的WebVTT时间戳映射
 int main (int argc, char *argv[]) {
-  MediaPlayer player("../a.flv"); 
+  const char *url = "../a.flv";
+  PlayerOptions options;
+  ThumbnailOptions thumbs;
+  bool thumbnail_mode = false;
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--live") == 0)
+    {
+      options.live = true;
+    }
+    else if(strcmp(argv[i], "--live-latency") == 0 && i + 1 < argc)
+    {
+      options.live_latency = atof(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--mmap-io") == 0)
+    {
+      options.mmap_io = true;
+    }
+    else if(strcmp(argv[i], "--output-size") == 0 && i + 1 < argc)
+    {
+      sscanf(argv[++i], "%dx%d", &options.output_width, &options.output_height);
+    }
+    else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+    {
+      options.record_path = argv[++i];
+    }
+    else if(strcmp(argv[i], "--thumbnails") == 0 && i + 1 < argc)
+    {
+      thumbnail_mode = true;
+      thumbs.count = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--thumb-width") == 0 && i + 1 < argc)
+    {
+      thumbs.width = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--columns") == 0 && i + 1 < argc)
+    {
+      thumbs.columns = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+    {
+      thumbs.threads = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--sprite") == 0 && i + 1 < argc)
+    {
+      thumbs.sprite_path = argv[++i];
+    }
+    else if(strcmp(argv[i], "--map") == 0 && i + 1 < argc)
+    {
+      thumbs.map_path = argv[++i];
+    }
+    else
+    {
+      url = argv[i];
+    }
+  }
+  if(thumbnail_mode)
+  {
+    options.headless = true;
+    MediaPlayer player(url, DEFAULT_AV_SYNC_TYPE, options);
+    return player.extract_thumbnails(thumbs) ? 0 : 1;
+  }
+  //直播模式在构造函数里会改成以外部时钟为主
+  MediaPlayer player(url, DEFAULT_AV_SYNC_TYPE, options);
   player.start();
   return 0;
 }
@@ -0,0 +1,26 @@
+#pragma once
+#include <cmath>
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+//serial在每次seek后加一,和当前serial不一致的包和帧都是seek之前的旧数据,消费者直接丢掉
+//pkt/frame为空的是结束标记:读到文件末尾后放进包队列,解码线程冲完解码器后再放进帧队列
+struct Packet
+{
+  AVPacket *pkt;
+  int serial;
+};
+//解码出来的一帧的显示时间(秒),播放流水线和GOP缓存都用它,逐帧步进和继续播放时两边的时间才对得上;没有时间戳时返回NAN
+inline double frame_pts(const AVFrame *frame, AVRational time_base)
+{
+  return frame->best_effort_timestamp == AV_NOPTS_VALUE ? NAN : frame->best_effort_timestamp * av_q2d(time_base);
+}
+
+struct Frame
+{
+  AVFrame *frame;
+  double pts;//为什么要特意写pts,因为有可能原视频的pts丢失或者找不到，需要我们自己写
+  int data_bytes = 0;//每帧的字节数，方便音频同步时使用
+  int serial = 0;
+};
@@ -0,0 +1,187 @@
+#pragma once
+#include "spsc_queue.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+//队列的上限,字节数和缓冲时长任一达到上限生产者就会阻塞
+struct QueueLimits
+{
+  int64_t max_bytes;
+  double max_duration;//秒
+};
+
+//队列当前状态和历史最高水位
+struct QueueStats
+{
+  size_t size{0};
+  int64_t bytes{0};
+  double duration{0.0};
+  size_t size_high_water{0};
+  int64_t bytes_high_water{0};
+  double duration_high_water{0.0};
+};
+
+/*
+ * 在SpscQueue的基础上按字节数和媒体时长做背压
+ * 队列满了生产者阻塞等待,而不是丢掉最旧的数据(丢视频包会导致花屏直到下一个关键帧)
+ * 队列为空时总是允许push,避免单个超大的数据把流水线卡死
+ */
+template <typename T>
+class MediaQueue {
+public:
+  MediaQueue(size_t slots, QueueLimits limits) : q_(slots), limits_(limits) {}
+
+  //生产者调用,超过上限时阻塞等待,超时返回false
+  bool push(const T &item, int64_t bytes, double duration, std::chrono::milliseconds timeout)
+  {
+    while(over_limit())
+    {
+      if(q_.closed())
+      {
+        return false;
+      }
+      uint32_t seq = space_.prepare_wait();
+      if(!over_limit() || q_.closed())
+      {
+        space_.cancel_wait();
+        continue;
+      }
+      space_.wait(seq, timeout);
+      if(over_limit())
+      {
+        return false;
+      }
+    }
+    int64_t duration_us = (int64_t)(duration * 1000000);
+    if(!q_.push({item, bytes, duration_us}, timeout))
+    {
+      return false;
+    }
+    account(bytes, duration_us);
+    return true;
+  }
+
+  //生产者调用,不检查字节数和时长的上限,只有槽位用完时返回false
+  //执行器上的任务不能阻塞,要先用over_limit()判断,所以这时上限是软的,最多超出一次push的量;
+  //over_limit()也包括槽位用完的情况,判断过之后push一个一定放得进去
+  bool try_push(const T &item, int64_t bytes, double duration)
+  {
+    int64_t duration_us = (int64_t)(duration * 1000000);
+    if(!q_.try_push({item, bytes, duration_us}))
+    {
+      return false;
+    }
+    account(bytes, duration_us);
+    return true;
+  }
+
+  //消费者调用
+  bool try_pop(T &item)
+  {
+    Entry e;
+    if(!q_.try_pop(e))
+    {
+      return false;
+    }
+    release(e);
+    item = e.item;
+    return true;
+  }
+
+  //消费者调用,队列空时阻塞等待,超时返回false
+  bool pop(T &item, std::chrono::milliseconds timeout)
+  {
+    Entry e;
+    if(!q_.pop(e, timeout))
+    {
+      return false;
+    }
+    release(e);
+    item = e.item;
+    return true;
+  }
+
+  //消费者调用,等待队列非空但不取出数据
+  bool wait(std::chrono::milliseconds timeout) { return q_.wait(timeout); }
+
+  void wake_all()
+  {
+    q_.wake_all();
+    space_.notify();
+  }
+
+  //关闭队列,阻塞在push/pop/wait上的线程立刻返回false,之后也不再阻塞;剩下的数据仍然可以try_pop取出
+  void close()
+  {
+    q_.close();
+    space_.notify();
+  }
+
+  //字节数或时长达到上限,或者槽位用完了,push会阻塞
+  bool over_limit() const
+  {
+    if(q_.empty())
+    {
+      return false;
+    }
+    return q_.full() || bytes_.load() >= limits_.max_bytes ||
+           duration_us_.load() >= (int64_t)(limits_.max_duration * 1000000);
+  }
+
+  size_t size() const { return q_.size(); }
+  bool empty() const { return q_.empty(); }
+  int64_t bytes() const { return bytes_.load(); }
+  double duration() const { return duration_us_.load() / 1000000.0; }
+
+  QueueStats stats() const
+  {
+    QueueStats s;
+    s.size = q_.size();
+    s.bytes = bytes_.load();
+    s.duration = duration_us_.load() / 1000000.0;
+    s.size_high_water = size_high_water_.load(std::memory_order_relaxed);
+    s.bytes_high_water = bytes_high_water_.load(std::memory_order_relaxed);
+    s.duration_high_water = duration_high_water_.load(std::memory_order_relaxed) / 1000000.0;
+    return s;
+  }
+
+private:
+  struct Entry
+  {
+    T item;
+    int64_t bytes;
+    int64_t duration_us;
+  };
+
+  //只有生产者会增加计数,所以最高水位可以直接在这里更新
+  void account(int64_t bytes, int64_t duration_us)
+  {
+    int64_t cur_bytes = bytes_.fetch_add(bytes) + bytes;
+    int64_t cur_duration = duration_us_.fetch_add(duration_us) + duration_us;
+    bytes_high_water_.store(std::max(bytes_high_water_.load(std::memory_order_relaxed), cur_bytes), std::memory_order_relaxed);
+    duration_high_water_.store(std::max(duration_high_water_.load(std::memory_order_relaxed), cur_duration), std::memory_order_relaxed);
+    size_high_water_.store(std::max(size_high_water_.load(std::memory_order_relaxed), q_.size()), std::memory_order_relaxed);
+  }
+
+  void release(const Entry &e)
+  {
+    int64_t old_bytes = bytes_.fetch_sub(e.bytes);
+    int64_t old_duration = duration_us_.fetch_sub(e.duration_us);
+    //只有之前超过上限或者槽位用完时生产者才可能在等待
+    if(old_bytes >= limits_.max_bytes || old_duration >= (int64_t)(limits_.max_duration * 1000000) ||
+       q_.size() + 1 >= q_.capacity())
+    {
+      space_.notify();
+    }
+  }
+
+  SpscQueue<Entry> q_;
+  QueueLimits limits_;
+  alignas(CACHELINE_SIZE) std::atomic<int64_t> bytes_{0};
+  std::atomic<int64_t> duration_us_{0};
+  alignas(CACHELINE_SIZE) FutexEvent space_;
+  std::atomic<int64_t> bytes_high_water_{0};
+  std::atomic<int64_t> duration_high_water_{0};
+  std::atomic<size_t> size_high_water_{0};
+};
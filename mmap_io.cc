@@ -0,0 +1,124 @@
+#include "mmap_io.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MmapIO::~MmapIO()
+{
+  if(avio_)
+  {
+    //缓冲区可能被avio换成了别的,要释放它当前持有的那一块
+    av_freep(&avio_->buffer);
+    avio_context_free(&avio_);
+  }
+  if(data_)
+  {
+    munmap(data_, size_);
+  }
+}
+
+bool MmapIO::open(const std::string &path, size_t window)
+{
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if(fd < 0)
+  {
+    return false;
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+  {
+    close(fd);
+    return false;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  //映射建立之后就不再需要文件描述符了
+  close(fd);
+  if(map == MAP_FAILED)
+  {
+    return false;
+  }
+  data_ = (uint8_t *)map;
+  size_ = st.st_size;
+  window_ = std::max(window, DEFAULT_BUFFER_SIZE);
+  madvise(data_, size_, MADV_SEQUENTIAL);
+  prefetch(0);
+
+  uint8_t *buffer = (uint8_t *)av_malloc(DEFAULT_BUFFER_SIZE);
+  if(!buffer)
+  {
+    return false;
+  }
+  avio_ = avio_alloc_context(buffer, DEFAULT_BUFFER_SIZE, 0, this, read_packet, NULL, seek);
+  if(!avio_)
+  {
+    av_free(buffer);
+    return false;
+  }
+  return true;
+}
+
+void MmapIO::prefetch(size_t pos)
+{
+  //还在已经预读的窗口前半段里,不用再预读
+  if(pos >= prefetched_begin_ && pos + window_ / 2 < prefetched_end_)
+  {
+    return;
+  }
+  //madvise要求起始地址按页对齐
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t begin = pos / page * page;
+  size_t end = std::min(size_, begin + window_);
+  if(begin < end)
+  {
+    madvise(data_ + begin, end - begin, MADV_WILLNEED);
+  }
+  prefetched_begin_ = begin;
+  prefetched_end_ = end;
+}
+
+int MmapIO::read_packet(void *opaque, uint8_t *buf, int buf_size)
+{
+  MmapIO *io = (MmapIO *)opaque;
+  if(io->pos_ >= io->size_)
+  {
+    return AVERROR_EOF;
+  }
+  size_t n = std::min((size_t)buf_size, io->size_ - io->pos_);
+  memcpy(buf, io->data_ + io->pos_, n);
+  io->pos_ += n;
+  io->prefetch(io->pos_);
+  return (int)n;
+}
+
+int64_t MmapIO::seek(void *opaque, int64_t offset, int whence)
+{
+  MmapIO *io = (MmapIO *)opaque;
+  int64_t pos;
+  switch(whence & ~AVSEEK_FORCE)
+  {
+    case AVSEEK_SIZE:
+      return io->size_;
+    case SEEK_SET:
+      pos = offset;
+      break;
+    case SEEK_CUR:
+      pos = (int64_t)io->pos_ + offset;
+      break;
+    case SEEK_END:
+      pos = (int64_t)io->size_ + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  if(pos < 0 || pos > (int64_t)io->size_)
+  {
+    return AVERROR(EINVAL);
+  }
+  io->pos_ = pos;
+  //跳到了预读窗口之外时从新位置重新预读
+  io->prefetch(io->pos_);
+  return pos;
+}
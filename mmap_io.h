@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+/*
+ * 基于mmap的AVIOContext,只用于本地普通文件
+ * 默认的file协议每次read()只读一小块,大文件demux时系统调用很多
+ * 这里把整个文件映射进来,read_packet只是一次memcpy,
+ * 并用madvise(SEQUENTIAL)告诉内核顺序读,提前对接下来的一个窗口做WILLNEED预读,seek之后从新位置重新预读
+ */
+class MmapIO {
+public:
+  //AVIOContext内部缓冲区大小和每次预读窗口的大小
+  static constexpr size_t DEFAULT_BUFFER_SIZE = 256 * 1024;
+  static constexpr size_t DEFAULT_WINDOW = 8 * 1024 * 1024;
+
+  MmapIO() = default;
+  ~MmapIO();
+  MmapIO(const MmapIO &) = delete;
+  MmapIO &operator=(const MmapIO &) = delete;
+
+  //映射文件并创建AVIOContext,失败返回false(比如不是本地文件)
+  bool open(const std::string &path, size_t window = DEFAULT_WINDOW);
+  //交给AVFormatContext::pb使用,所有权仍然归MmapIO
+  AVIOContext *context() const { return avio_; }
+
+private:
+  static int read_packet(void *opaque, uint8_t *buf, int buf_size);
+  static int64_t seek(void *opaque, int64_t offset, int whence);
+  //读到预读窗口的后半段,或者seek到窗口之外时,从pos开始预读一个窗口
+  void prefetch(size_t pos);
+
+  uint8_t *data_{nullptr};
+  size_t size_{0};
+  size_t pos_{0};
+  size_t window_{DEFAULT_WINDOW};
+  size_t prefetched_begin_{0};
+  size_t prefetched_end_{0};
+  AVIOContext *avio_{nullptr};
+};
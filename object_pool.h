@@ -0,0 +1,78 @@
+#pragma once
+#include "spsc_queue.h"
+#include <atomic>
+#include <cstdint>
+
+/*
+ * AVFrame/AVPacket 外壳对象池
+ * 播放器里每一对线程都是固定的: 一个线程负责acquire(生产者), 另一个线程负责release(消费者)
+ * 所以空闲列表直接复用SpscQueue, release方是队列的生产者, acquire方是队列的消费者
+ * 对象归还时只unref掉引用的数据, 外壳本身留着下次复用, 稳定播放后不会再有外壳的分配
+ */
+template <typename T, T *(*Alloc)(), void (*Free)(T **), void (*Reset)(T *)>
+class ObjectPool {
+public:
+  explicit ObjectPool(size_t capacity) : free_(capacity) {}
+  ObjectPool(const ObjectPool &) = delete;
+  ObjectPool &operator=(const ObjectPool &) = delete;
+  ~ObjectPool()
+  {
+    T *obj = nullptr;
+    while(free_.try_pop(obj))
+    {
+      Free(&obj);
+    }
+    Free(&spare_);
+  }
+
+  //只能在acquire方线程调用
+  T *acquire()
+  {
+    T *obj = nullptr;
+    if(spare_)
+    {
+      obj = spare_;
+      spare_ = nullptr;
+      return obj;
+    }
+    if(free_.try_pop(obj))
+    {
+      return obj;
+    }
+    allocations_.fetch_add(1, std::memory_order_relaxed);
+    return Alloc();
+  }
+
+  //只能在acquire方线程调用, 把拿到但没用上的对象还回来(比如解码返回EAGAIN时的空帧)
+  void put_back(T *obj)
+  {
+    if(!obj)return;
+    Reset(obj);
+    if(spare_)
+    {
+      Free(&obj);
+      return;
+    }
+    spare_ = obj;
+  }
+
+  //只能在release方线程调用
+  void release(T *obj)
+  {
+    if(!obj)return;
+    Reset(obj);
+    //空闲列表满了说明同时存活的对象太多了,直接释放
+    if(!free_.try_push(obj))
+    {
+      Free(&obj);
+    }
+  }
+
+  //累计真正调用Alloc的次数
+  uint64_t allocations() const { return allocations_.load(std::memory_order_relaxed); }
+
+private:
+  SpscQueue<T *> free_;
+  T *spare_{nullptr};
+  std::atomic<uint64_t> allocations_{0};
+};
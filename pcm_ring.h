@@ -0,0 +1,175 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "spsc_queue.h"
+
+/*
+ * 单生产者单消费者的PCM字节环形缓冲区
+ * 音频解码线程写入已经重采样好的数据,声卡回调只做memcpy读出
+ * 读端不加锁、不分配内存、不等待,只在写端正在等空间时才进内核唤醒它
+ * 读写位置是一直累加的字节数,不回绕,可以直接当作数据流里的偏移量使用
+ */
+class PcmRing {
+public:
+  //容量向上取整到2的幂
+  explicit PcmRing(size_t capacity)
+  {
+    size_t cap = 2;
+    while(cap < capacity)
+    {
+      cap <<= 1;
+    }
+    mask_ = cap - 1;
+    buf_.resize(cap);
+  }
+
+  //写入最多n字节,返回实际写入的字节数
+  size_t write(const uint8_t *data, size_t n)
+  {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    uint64_t head = head_.load(std::memory_order_acquire);
+    n = std::min(n, capacity() - (size_t)(tail - head));
+    copy_in(tail, data, n);
+    tail_.store(tail + n, std::memory_order_release);
+    //和SpscQueue一样的Dekker同步:写完之后再看一次head,写之前是空的才唤醒读端
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(n > 0 && head_.load(std::memory_order_relaxed) == tail)
+    {
+      data_.notify();
+    }
+    return n;
+  }
+
+  //写满n字节才返回,空间不够时等待读端,超时返回false(已经写入的部分不会回退,见written)
+  bool write_all(const uint8_t *data, size_t n, std::chrono::milliseconds timeout)
+  {
+    while(n > 0)
+    {
+      size_t w = write(data, n);
+      data += w;
+      n -= w;
+      if(n == 0)
+      {
+        break;
+      }
+      if(closed_)
+      {
+        return false;
+      }
+      uint32_t seq = space_.prepare_wait();
+      if(!full() || closed_)
+      {
+        space_.cancel_wait();
+        continue;
+      }
+      space_.wait(seq, timeout);
+      if(full())
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  //读出最多n字节,返回实际读出的字节数
+  size_t read(uint8_t *out, size_t n)
+  {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t tail = tail_.load(std::memory_order_acquire);
+    n = std::min(n, (size_t)(tail - head));
+    copy_out(head, out, n);
+    head_.store(head + n, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    //读之前是满的,写端可能在等待
+    if(n > 0 && tail_.load(std::memory_order_relaxed) - head == capacity())
+    {
+      space_.notify();
+    }
+    return n;
+  }
+
+  //丢弃最多n字节,用于seek之后跳过旧数据,返回实际丢弃的字节数
+  size_t skip(size_t n)
+  {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t tail = tail_.load(std::memory_order_acquire);
+    n = std::min(n, (size_t)(tail - head));
+    head_.store(head + n, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(n > 0 && tail_.load(std::memory_order_relaxed) - head == capacity())
+    {
+      space_.notify();
+    }
+    return n;
+  }
+
+  //等待有数据可读,超时返回false
+  bool wait(std::chrono::milliseconds timeout)
+  {
+    if(!empty() || closed_)
+    {
+      return !empty();
+    }
+    uint32_t seq = data_.prepare_wait();
+    if(!empty() || closed_)
+    {
+      data_.cancel_wait();
+      return !empty();
+    }
+    data_.wait(seq, timeout);
+    return !empty();
+  }
+
+  void wake_all()
+  {
+    data_.notify();
+    space_.notify();
+  }
+
+  //和SpscQueue::close一样,之后write_all/wait不再阻塞
+  void close()
+  {
+    closed_.store(true, std::memory_order_seq_cst);
+    wake_all();
+  }
+
+  //累计写入/读出的字节数
+  uint64_t written() const { return tail_.load(std::memory_order_acquire); }
+  uint64_t consumed() const { return head_.load(std::memory_order_acquire); }
+  size_t size() const
+  {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    return (size_t)(tail_.load(std::memory_order_acquire) - head);
+  }
+  bool empty() const { return size() == 0; }
+  bool full() const { return size() == capacity(); }
+  size_t capacity() const { return mask_ + 1; }
+
+private:
+  void copy_in(uint64_t pos, const uint8_t *data, size_t n)
+  {
+    size_t off = pos & mask_;
+    size_t first = std::min(n, capacity() - off);
+    memcpy(buf_.data() + off, data, first);
+    memcpy(buf_.data(), data + first, n - first);
+  }
+  void copy_out(uint64_t pos, uint8_t *out, size_t n)
+  {
+    size_t off = pos & mask_;
+    size_t first = std::min(n, capacity() - off);
+    memcpy(out, buf_.data() + off, first);
+    memcpy(out + first, buf_.data(), n - first);
+  }
+
+  std::vector<uint8_t> buf_;
+  size_t mask_;
+  alignas(CACHELINE_SIZE) std::atomic<uint64_t> head_{0};
+  alignas(CACHELINE_SIZE) std::atomic<uint64_t> tail_{0};
+  FutexEvent data_;
+  FutexEvent space_;
+  std::atomic_bool closed_{false};
+};
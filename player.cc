@@ -1,16 +1,32 @@
 #include "player.h"
+#include "clock.h"
 #include <SDL2/SDL_events.h>
 #include <SDL2/SDL_keycode.h>
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
 #include <cstring>
 #include <libavutil/mem.h>
 #include <libavutil/rational.h>
 #include <sys/select.h>
+#include <sys/resource.h>
+#include <ctime>
+#include <cstdio>
 
-MediaPlayer::MediaPlayer(const char* url, AV_SYNC_TYPE av_sync_type)
+namespace
+{
+  //当前线程消耗的cpu时间,线程结束前调用一次即可得到该阶段的总cpu时间
+  double thread_cpu_seconds()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+}
+
+MediaPlayer::MediaPlayer(const char* url, AV_SYNC_TYPE av_sync_type, const PlayerOptions &options)
+  : options_(options), av_sync_type(av_sync_type)
 {
-  th.resize(4);
   /*
   * AVFormatContext 包含了媒体信息有关的成员
   * struct AVInputFormat *iformat //封装格式的信息
@@ -47,16 +63,66 @@ MediaPlayer::MediaPlayer(const char* url, AV_SYNC_TYPE av_sync_type)
   *   int frame_size //每个音频帧的sample个数
   */
   url_ = url;
+  open_begin = monotonic_now();
+  install_stats_signal_handler();
+  if(options_.live)
+  {
+    avformat_network_init();
+    //直播流没有稳定的音频时钟可以参考,播放速度由数据到达的速度决定
+    if(this->av_sync_type != AV_SYNC_TYPE::AV_SYNC_EXTERNAL_MASTER)
+    {
+      std::cout << "直播模式使用外部时钟作为主时钟" << std::endl;
+      this->av_sync_type = AV_SYNC_TYPE::AV_SYNC_EXTERNAL_MASTER;
+    }
+  }
 
   //1.该函数负责服务器的连接和码流头部信息的拉取
   //第三个参数指定媒体文件格式,第四个指定文件格式相关选项,如果为null,那么avformat则自动探测文件格式
-  if(avformat_open_input(&pFormatCtx, url_, NULL, NULL) != 0)
+  AVDictionary *format_opts = NULL;
+  if(options_.probesize > 0)
+  {
+    av_dict_set_int(&format_opts, "probesize", options_.probesize, 0);
+  }
+  if(options_.analyzeduration > 0)
+  {
+    av_dict_set_int(&format_opts, "analyzeduration", options_.analyzeduration, 0);
+  }
+  if(options_.live)
+  {
+    //不让demuxer自己再攒一批包,缓冲全部由jitter buffer控制
+    av_dict_set(&format_opts, "fflags", "nobuffer", 0);
+  }
+  if(options_.mmap_io)
+  {
+    mmap_reader.reset(new MmapIO());
+    if(mmap_reader->open(url_))
+    {
+      //自己提供pb,avformat_open_input就不会再打开文件
+      pFormatCtx = avformat_alloc_context();
+      pFormatCtx->pb = mmap_reader->context();
+    }
+    else
+    {
+      std::cerr << "mmap打开失败,使用默认的读取方式:" << url_ << std::endl;
+      mmap_reader.reset();
+    }
+  }
+  if(!pFormatCtx)
+  {
+    pFormatCtx = avformat_alloc_context();
+  }
+  //quit()之后阻塞在网络读取上的av_read_frame立刻返回
+  pFormatCtx->interrupt_callback.callback = interruptCallback;
+  pFormatCtx->interrupt_callback.opaque = this;
+  int open_ret = avformat_open_input(&pFormatCtx, url_, NULL, &format_opts);
+  av_dict_free(&format_opts);
+  if(open_ret != 0)
   {
     std::cerr << "打开媒体文件失败:" << stderr << std::endl;
     return ;
   }
   //2.媒体信息的探测和分析函数,填充pFormatCtx->streams对应的信息
-  if(avformat_find_stream_info(pFormatCtx, NULL) < 0)
+  if(!probe_stream_info())
   {
     std::cerr << "探测文件信息失败:" << stderr << std::endl;
     return ;
@@ -115,23 +181,28 @@ MediaPlayer::MediaPlayer(const char* url, AV_SYNC_TYPE av_sync_type)
   }
 
   //8.初始化解码器上下文
+  //多线程解码要在avcodec_open2之前设置,thread_count为0表示由libavcodec按cpu核数决定
+  //帧线程:多帧同时解码,吞吐高但每多一个线程输出就多延迟一帧;片线程:一帧内按slice并行,不增加延迟
+  pCodecCtx->thread_count = options_.decode_threads;
+  if(options_.executor && options_.decode_threads <= 0)
+  {
+    pCodecCtx->thread_count = 1;
+  }
+  pCodecCtx->thread_type = options_.decode_thread_type;
+  choose_output_size();
   if(avcodec_open2(pCodecCtx, pCodec, NULL) < 0)
   {
     std::cerr << "初始化视频解码器上下文失败" << stderr << std::endl;
     return;
   }
+  print_decode_threading();
   if(avcodec_open2(aCodecCtx, aCodec, NULL) < 0)
   {
     std::cerr << "初始化音频解码器上下文失败" << stderr << std::endl;
     return;
   }
   allocFrame();
-  //初始化sdl
-  if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER))
-  {
-    std::cerr << "初始化sdl失败:" << SDL_GetError();
-    return;
-  }
+  //sdl的窗口和声卡在start()里和解码并行创建,见sdl_init和open_audio_device
   //初始化sdl音频设置
   wanted_spec.freq = aCodecCtx->sample_rate;//采样率
   wanted_spec.format = AUDIO_S16SYS;//音频数据格式, singned 16bits 大小端和系统保持一致
@@ -149,10 +220,7 @@ MediaPlayer::MediaPlayer(const char* url, AV_SYNC_TYPE av_sync_type)
   audio_diff_threshold = 2.0 * SDL_AUDIO_BUFFER_SIZE / aCodecCtx->sample_rate;
 
 
-  //初始化滤镜上下文
-  sws_ctx = sws_getContext(pCodecCtx->width, pCodecCtx->height,
-                           pCodecCtx->pix_fmt, pCodecCtx->width, pCodecCtx->height,
-                           AV_PIX_FMT_YUV420P, SWS_BILINEAR, NULL, NULL, NULL);
+  //滤镜上下文sws_ctx在真正需要格式转换时才创建,见upload_frame
   //初始化SwrContext
   int ret = swr_alloc_set_opts2(&swr_ctx, &aCodecCtx->ch_layout, 
                                 AV_SAMPLE_FMT_S16, aCodecCtx->sample_rate,
@@ -164,18 +232,41 @@ MediaPlayer::MediaPlayer(const char* url, AV_SYNC_TYPE av_sync_type)
     return;
   }
   swr_init(swr_ctx);
-
-  //打开音频
-  if(SDL_OpenAudio(&wanted_spec, &spec) < 0)
+  //采样率和声道布局都不变,平时只是格式转换,用特化的转换函数;swr只在同步需要伸缩采样数时使用
+  AudioIsa isa = best_audio_isa();
+  int channels = aCodecCtx->ch_layout.nb_channels;
+  audio_converter = select_audio_converter(aCodecCtx->sample_fmt, channels, options_.audio_gain == 1.0f, isa);
+  if(options_.audio_gain != 1.0f)
   {
-    std::cerr << "sdl打开音频失败:" << SDL_GetError() << std::endl;
-    return;
+    swr_gain = select_audio_converter(AV_SAMPLE_FMT_S16, channels, false, isa);
   }
+  std::cout << "音频格式转换: " << av_get_sample_fmt_name(aCodecCtx->sample_fmt) << " -> s16, " << audio_converter.name
+            << std::endl;
 
-  //开始播放音频
-  SDL_PauseAudio(0);
+  //先按期望的格式填好spec,真正打开声卡后会被实际的参数覆盖;无头模式由null_audio_sink代替声卡拉取数据
+  spec = wanted_spec;
+  spec.size = spec.samples * spec.channels * 2;
+  //环形缓冲区至少要比声卡一次取走的数据大
+  size_t ring_bytes = (size_t)(options_.audio_ring_duration * spec.freq) * spec.channels * 2;
+  pcm_ring.reset(new PcmRing(std::max<size_t>(ring_bytes, 4 * spec.size)));
 
-  std::cout << "初始化完毕" << std::endl;
+  if(options_.keyframe_index && !options_.live)
+  {
+    init_keyframe_index();
+  }
+  if(!options_.record_path.empty())
+  {
+    recorder.reset(new Recorder(options_.record_path, pFormatCtx, videoStreamIndex, audioStreamIndex, options_.record_limits));
+    if(!recorder->is_opened())
+    {
+      //录制失败不影响播放
+      recorder.reset();
+    }
+  }
+  opened = true;
+  open_end = monotonic_now();
+  std::cout << "初始化完毕,耗时" << (open_end - open_begin) * 1000 << "ms" << (stream_cache_hit ? "(命中流信息缓存)" : "")
+            << std::endl;
 }
  
 void MediaPlayer::allocFrame()  {
@@ -203,65 +294,266 @@ void MediaPlayer::allocFrame()  {
   //                     pCodecCtx->width, pCodecCtx->height, 1);
   //方式二:
   //既能申请内存又能格式化数据 相当于上面三个函数
-  av_image_alloc(pFrameYUV->data, pFrameYUV->linesize, 
-                 pCodecCtx->width, pCodecCtx->height, AV_PIX_FMT_YUV420P, 1);
-  //上面这个函数并不会设置下面这两个值
-  pFrameYUV->width  = pCodecCtx->width;
-  pFrameYUV->height = pCodecCtx->height;
+  //av_image_alloc(pFrameYUV->data, pFrameYUV->linesize, 
+  //               pCodecCtx->width, pCodecCtx->height, AV_PIX_FMT_YUV420P, 1);
+  //方式三:
+  //sws_scale_frame要求目标帧是引用计数的(buf[0]不为空),所以用av_frame_get_buffer分配
+  //转换直接输出到显示大小,小窗口播放高分辨率视频时后面的上传和显示都只处理显示大小的像素
+  pFrameYUV->width  = out_width;
+  pFrameYUV->height = out_height;
+  pFrameYUV->format = AV_PIX_FMT_YUV420P;
+  if(av_frame_get_buffer(pFrameYUV, 0) < 0)
+  {
+    std::cerr << "分配转换帧空间失败" << std::endl;
+  }
 }
  
 void MediaPlayer::readData()  {
   //开始从视频流中读取数据包
-  while(!is_close && av_read_frame(pFormatCtx, packet) >= 0)
-  {
-    packet_queue_put();
-    //释放掉packet指向的内存,以方便读下一个包
-    av_packet_unref(packet);
-    SDL_PollEvent(&event);
-    switch (event.type) {
-      case SDL_QUIT:
-        std::cout << "SDL_QUIT" << std::endl;
-        is_close = true;
-        break;
-      case SDL_KEYDOWN:
-        switch(event.key.keysym.sym)
-        {
-          case SDLK_LEFT:
-            incr = -10.0;
-            goto do_seek;
-          case SDLK_RIGHT:
-            incr = 10.0;
-            goto do_seek;
-          case SDLK_UP:
-            incr = 60.0;
-            goto do_seek;
-          case SDLK_DOWN:
-            incr = -60.0;
-            goto do_seek;
-          do_seek:
-            break;
-        }
+  while(!is_close)
+  {
+    if(seek_req)
+    {
+      do_seek();
+    }
+    if(demux_one())
+    {
+      continue;
+    }
+    //读到末尾:放结束标记(只在quit()时失败),然后等seek或者quit(),seek之后接着读新的位置
+    if(!send_eof())
+    {
+      break;
     }
+    //直播流不能seek,读完就结束
+    if(options_.live)
+    {
+      break;
+    }
+    wait_seek_or_quit();
   }
-  is_close = true;
+  finish_demux();
+  demux_cpu = thread_cpu_seconds();
+}
+
+//读一个包送进对应的队列,读完或者出错时返回false
+bool MediaPlayer::demux_one()  {
+  int ret;
+  {
+    ScopedTimer timer(metrics.stage(Stage::READ_FRAME));
+    ret = av_read_frame(pFormatCtx, packet);
+  }
+  if(ret < 0)
+  {
+    return false;
+  }
+  demux_bytes += packet->size;
+  //录制只增加一次引用,要在packet_queue_put把引用移走之前
+  if(recorder)
+  {
+    recorder->put(packet);
+  }
+  if(options_.live)
+  {
+    live_update();
+  }
+  packet_queue_put();
+  //释放掉packet指向的内存,以方便读下一个包
+  av_packet_unref(packet);
+  return true;
+}
+
+void MediaPlayer::finish_demux()  {
   std::cout << "读取数据结束" << std::endl;
 }
 
+//读到文件末尾(或者读取出错)后,解码线程不用再靠超时猜是否结束,收到结束标记就冲解码器然后退出
+bool MediaPlayer::send_eof()  {
+  if(!video_eof_sent)
+  {
+    video_eof_sent = queue_eof(vPacket_queue);
+  }
+  if(!audio_eof_sent)
+  {
+    audio_eof_sent = queue_eof(aPacket_queue);
+  }
+  return video_eof_sent && audio_eof_sent;
+}
+
+void MediaPlayer::wait_seek_or_quit()  {
+  uint32_t seq = demux_event.prepare_wait();
+  if(seek_req || is_close)
+  {
+    demux_event.cancel_wait();
+    return;
+  }
+  demux_event.wait(seq, QUEUE_POP_TIMEOUT);
+}
+
+bool MediaPlayer::queue_eof(PacketQueue &q)  {
+  if(options_.executor)
+  {
+    return q.try_push({NULL, serial}, 0, 0);
+  }
+  //结束标记不占字节数和时长,但队列超过上限时还是要等解码线程取走数据
+  while(!q.push({NULL, serial}, 0, 0, QUEUE_PUSH_TIMEOUT))
+  {
+    if(is_close)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void MediaPlayer::quit()  {
+  is_close = true;
+  //关闭所有队列,阻塞在push/pop上的线程立刻返回,不用等超时
+  vPacket_queue.close();
+  aPacket_queue.close();
+  vFrame_queue.close();
+  if(pcm_ring)
+  {
+    pcm_ring->close();
+  }
+  quit_event.notify();
+  demux_event.notify();
+}
+
+double MediaPlayer::sleep_until_or_quit(double target)  {
+  //睡眠部分等在quit_event上,剩下最后一点和precise_sleep_until一样自旋
+  const double spin = 0.002;
+  double left = target - monotonic_now();
+  if(left > spin)
+  {
+    uint32_t seq = quit_event.prepare_wait();
+    if(is_close)
+    {
+      quit_event.cancel_wait();
+      return NAN;
+    }
+    quit_event.wait(seq, std::chrono::milliseconds((int64_t)((left - spin) * 1000)));
+  }
+  if(is_close)
+  {
+    return NAN;
+  }
+  return precise_sleep_until(target);
+}
+
+//处理窗口和键盘事件
+void MediaPlayer::poll_events()  {
+  //没有新事件时不能再处理上一次的事件,否则一次按键会被当成很多次
+  if(!SDL_PollEvent(&event))
+  {
+    return;
+  }
+  switch (event.type) {
+    case SDL_QUIT:
+      std::cout << "SDL_QUIT" << std::endl;
+      quit();
+      break;
+    case SDL_KEYDOWN:
+      switch(event.key.keysym.sym)
+      {
+        case SDLK_LEFT:
+          incr = -10.0;
+          goto do_seek;
+        case SDLK_RIGHT:
+          incr = 10.0;
+          goto do_seek;
+        case SDLK_UP:
+          incr = 60.0;
+          goto do_seek;
+        case SDLK_DOWN:
+          incr = -60.0;
+          goto do_seek;
+        do_seek:
+          //从当前播放位置往前/往后跳
+          pos = get_master_clock();
+          if(std::isnan(pos))
+          {
+            pos = frame_last_pts;
+          }
+          pos += incr;
+          if(pos < 0)
+          {
+            pos = 0;
+          }
+          seek(pos, incr);
+          break;
+        case SDLK_s:
+          //按s键输出一次统计信息
+          dump_stats_req = true;
+          break;
+        case SDLK_PERIOD:
+          //.往后一帧 ,往前一帧,r倒放(再按一次停下),空格继续正常播放
+          step(1);
+          break;
+        case SDLK_COMMA:
+          step(-1);
+          break;
+        case SDLK_r:
+          play_reverse(!reverse_req);
+          break;
+        case SDLK_SPACE:
+          resume();
+          break;
+      }
+  }
+}
 
 MediaPlayer::~MediaPlayer()  {
+  //GOP缓存的后台线程可能还在用关键帧索引,先停掉它
+  gop_cache.reset();
+  av_frame_free(&scrub_frame);
+  index_cancel = true;
+  if(index_thread.joinable())
+  {
+    index_thread.join();
+  }
+
+  if(!options_.headless)
+  {
+    if(audio_dev)
+    {
+      SDL_CloseAudioDevice(audio_dev); // 先关闭音频播放（阻止后续回调）
+    }
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(render);
+    SDL_DestroyWindow(window);
+    //子系统是引用计数的,只退出自己初始化过的,不影响同一进程里的其它播放器
+    if(sdl_audio_inited)
+    {
+      SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    }
+    if(sdl_video_inited)
+    {
+      SDL_QuitSubSystem(SDL_INIT_VIDEO);
+    }
+  }
 
-  SDL_CloseAudio(); // 先关闭音频播放（阻止后续回调）
-  SDL_DestroyTexture(texture);
-  SDL_DestroyRenderer(render);
-  SDL_DestroyWindow(window);
-  SDL_Quit(); // SDL 清理
+  //线程都已经退出,把队列里剩下的对象释放掉
+  Packet p;
+  while(vPacket_queue.try_pop(p))av_packet_free(&p.pkt);
+  while(aPacket_queue.try_pop(p))av_packet_free(&p.pkt);
+  Frame f;
+  while(vFrame_queue.try_pop(f))av_frame_free(&f.frame);
+  for(PendingFrame &pf : pending_frames)av_frame_free(&pf.item.frame);
 
+  sws_freeContext(sws_ctx);
+  swr_free(&swr_ctx);
+  av_freep(&audio_buf);
   av_frame_free(&pFrameYUV); 
   av_frame_free(&pFrame);
   av_packet_free(&packet);
   avcodec_free_context(&pCodecCtx);
   avcodec_free_context(&aCodecCtx);
   avformat_close_input(&pFormatCtx);
+  if(options_.live)
+  {
+    avformat_network_deinit();
+  }
 }
 
  
@@ -269,45 +561,62 @@ MediaPlayer::~MediaPlayer()  {
 void MediaPlayer::showFrame()  {
   double delay, ref_clock, diff, sync_threshold, actual_delay;
   //初始化sdl, 这个函数需要和showFrame在一个线程里
-  sdl_init();
-  //获取开始显示帧的时间
-  gettimeofday(&start_time, NULL);
-  while(true)
-  {
-    std::unique_lock<std::mutex> lock(video_Frame_mtx);
-    video_Frame_cond.wait_for(lock, std::chrono::milliseconds(1000), [&](){
-      return !vFrame_queue.empty();
-    });
-    if(is_close && vFrame_queue.empty())break;
-    else if(vFrame_queue.empty())continue;
-    AVFrame *frame = vFrame_queue.front().frame;
-    double pts = vFrame_queue.front().pts;
-    video_current_pts = pts;
-    gettimeofday(&video_current_pts_time, NULL);
-    vFrame_queue.pop();
-
-    //将像素格式转换为我们想要的
-    auto ret = sws_scale(sws_ctx, frame->data, frame->linesize, 0,
-                        frame->height,pFrameYUV->data, pFrameYUV->linesize);
-    if(ret < 0)
+  if(!options_.headless)
+  {
+    sdl_init();
+  }
+  //frame_timer是单调时钟上的绝对时间,从开始显示帧的时间开始累加
+  frame_timer = monotonic_now();
+  //窗口事件要在创建窗口的线程里处理,有窗口时等帧的间隙也要定期处理
+  std::chrono::milliseconds pop_timeout = options_.headless ? QUEUE_POP_TIMEOUT : EVENT_POLL_INTERVAL;
+  while(!is_close)
+  {
+    if(!options_.headless)
     {
-      std::cerr << "视频转换格式失败" << std::endl;
-      return;
+      poll_events();
     }
-    //1.更新纹理的像素数据
-    auto ret1 = SDL_UpdateTexture(texture, rect, (const void *)pFrameYUV->data[0], pFrameYUV->linesize[0]);
-    if(ret1 < 0)
+    //步进和倒放时不从帧队列取帧,流水线靠背压停下来
+    if(scrub())
     {
-      std::cerr << "更新纹理失败" << std::endl;
-      return;
+      continue;
     }
-    SDL_RenderClear(render);
-    //2.复制纹理到渲染目标
-    auto ret2 = SDL_RenderCopy(render, texture, rect, rect);
-    if(ret2 < 0)
+    //当前位置的画面已经放完,声音也放完就结束;在这之前seek了就接着放新的位置
+    bool ended = video_end_serial == serial;
+    if(ended && !seek_req && audio_finished())
     {
-      std::cerr << "复制纹理失败" << std::endl;
-      return;
+      quit();
+      break;
+    }
+    Frame vf;
+    if(!vFrame_queue.pop(vf, ended ? EVENT_POLL_INTERVAL : pop_timeout))
+    {
+      continue;
+    }
+    //结束标记:解码器里的帧都已经显示完了;seek之前的旧标记不用管
+    if(!vf.frame)
+    {
+      if(vf.serial == serial)
+      {
+        video_end_serial = vf.serial;
+      }
+      continue;
+    }
+    if(!accept_frame(vf))
+    {
+      continue;
+    }
+    AVFrame *frame = vf.frame;
+    double pts = vf.pts;
+
+    //无头且不限速:只做格式转换,不上传纹理也不按时钟等待,全速消费
+    if(options_.headless && !options_.headless_paced)
+    {
+      if(!present_unpaced(vf))
+      {
+        quit();
+        return;
+      }
+      continue;
     }
     /*
      音视频同步逻辑详解(音频为主)：
@@ -323,7 +632,7 @@ void MediaPlayer::showFrame()  {
       设置frame_timer叠加每次的delay
       然后将frame_timer和系统时钟time进行对比
       那么该帧实际需要停留的时间就是actual_delay = frame_timer-time（让系统时钟到达我们设定的显示时间）
-      actual_delay如果过小设置一个最小显示时间(因为需要让一帧有停留时间，不然就相当于丢帧了)
+      如果这一帧在预计显示的时候已经错过了它的显示时段,并且后面还有帧,就直接丢掉,不做转换和上传
     */
     //pts是指这一帧显示完的时间点
     delay = pts - frame_last_pts; 
@@ -334,12 +643,15 @@ void MediaPlayer::showFrame()  {
     //为下个time保存
     frame_last_delay = delay;
     frame_last_pts = pts;
+    //这一帧正常应该显示的时长,用来判断是否已经来不及显示
+    double duration = delay;
 
+    ref_clock = NAN;
     //确保当视频始终作为参考时钟时不进行视频同步操作
     if(av_sync_type != AV_SYNC_TYPE::AV_SYNC_VIDEO_MASTER)
     {
       //获取音频时间⏰
-      ref_clock = get_audio_clock();
+      ref_clock = get_master_clock();
       
       //计算视频时间戳和音频时间之差
       diff = pts - ref_clock;
@@ -360,288 +672,1713 @@ void MediaPlayer::showFrame()  {
       }
     }
     frame_timer += delay;
-    //计算一下真实时间
-    gettimeofday(&cur_time, NULL);
-    //计算从开始读包到现在过去了多长时间
-    double time = (cur_time.tv_sec - start_time.tv_sec) + (cur_time.tv_usec - start_time.tv_usec) / 1000000.0;
-    //计算实际延迟
-    actual_delay = frame_timer - time;
-    if(actual_delay < 0.010)
+    //计算一下真实时间(单调时钟,不会因为校时而跳变)
+    double time = monotonic_now();
+    //预计的显示时间 = 现在 + 转换上传显示这一帧大概要花的时间
+    double predicted_present = time + render_cost_avg;
+    //在这一帧的显示时段结束之前都显示不出来,而且后面还有帧,丢掉这一帧
+    if(options_.drop_late_frames && predicted_present > frame_timer + duration && !vFrame_queue.empty() &&
+       consecutive_drops < MAX_CONSECUTIVE_DROPS)
     {
-      actual_delay = 0.010;
+      frames_dropped++;
+      consecutive_drops++;
+      trace_video(pts, ref_clock, delay, NAN, true);
+      vFrame_pool.release(frame);
+      continue;
+    }
+    consecutive_drops = 0;
+    //没法靠丢帧追上时(比如刚卡顿过,队列里又没有帧了)不再追赶之前的进度,从现在重新开始计时
+    if(time - frame_timer > AV_SYNC_THRESHOLD_MAX)
+    {
+      frame_timer = time;
     }
-    SDL_Delay(actual_delay * 1000 + 0.5);//+0.5是为了四舍五入
-    
-    //3.显示画面
-    SDL_RenderPresent(render);
-    //记得回收内存
-    av_frame_free(&frame);
-  }
-  std::cout << "视频播放结束" << std::endl;
-}
- 
-//初始化sdl
-void MediaPlayer::sdl_init()  {
-
-  //2.创建窗口
-  //创建一个标题为Video,窗口坐标在中间的宽高和视频一样的窗口
-  window = SDL_CreateWindow("Video", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, pCodecCtx->width, pCodecCtx->height, SDL_WINDOW_SHOWN);
-  if(!window)
-  {
-    std::cerr << "创建sdl窗口失败" << std::endl;
-    return;
-  }
-  //3.创建渲染器
-  //初始化默认的渲染设备，使用软件渲染,和显示器的刷新率同步
-  render = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-  if(!render)
-  {
-    std::cerr << "创建sdl渲染器失败" << std::endl;
-    return;
-  }
-  //4.创建纹理
-  texture = SDL_CreateTexture(render, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, pCodecCtx->width, pCodecCtx->height);
-  if(!texture)
-  {
-    std::cerr << "创建sdl纹理失败" << std::endl;
-    return;
-  }
-
-}
-
-void MediaPlayer::audioCallback(void *userdata, Uint8 *stream, int len) {
-  MediaPlayer* m = (MediaPlayer *)userdata;
-  m->audioDataRead(m->aCodecCtx, stream, len);
-}
 
-//音频回调函数
-void MediaPlayer::audioDataRead(void *userdata, Uint8 *stream, int len) {
-  AVCodecContext *aCodecCtx = (AVCodecContext *)userdata;
-  audio_buf_index = 0;
-  audio_buf_size = 0;
-  int len1 = 0;
-  //为何写个循环，因为要往len里填充数据，一帧音频帧可能不够,需要填充满
-  while(len > 0)
-  {
-    if(audio_buf_index >= audio_buf_size)
+    auto render_begin = std::chrono::steady_clock::now();
+    //1.必要时转换像素格式,然后更新纹理的像素数据(无头模式只转换)
+    if(options_.headless)
     {
-      std::unique_lock<std::mutex> lock(audio_Frame_mtx);
-      //注意点：这里选择先填充静音数据而不是直接返回，因为直接返回sdl会继续使用stream里的数据会形成杂音
-      if(aFrame_queue.empty())
+      if(convert_frame(frame) == NULL)
       {
-        memset(stream, 0, len);
+        quit();
         return;
       }
-      AVFrame *frame = aFrame_queue.front().frame;
-      //得到音频帧大小(注意这里没有很规范，因为下面转换格式了，正常应该下面转换格式后再获取数据大小，这里为了省事直接用之前的)
-      int audio_size = aFrame_queue.front().data_bytes;
-      //得到pts
-      audio_clock = aFrame_queue.front().pts;
-      aFrame_queue.pop();
-      //分配临时缓冲区
-      if(!audio_buf)
+    }
+    else
+    {
+      if(upload_frame(frame) < 0)
       {
-        audio_buf = (uint8_t*)av_malloc(192000);
+        quit();
+        return;
       }
-      //音频格式转换
-      int out_samples = swr_convert(swr_ctx, (uint8_t * const *)&audio_buf, frame->nb_samples, frame->extended_data, frame->nb_samples);
-      //同步音频时钟
-      audio_size = synchronize_audio((int16_t *)audio_buf, audio_size, audio_clock);
-      if(audio_size < 0)
+      SDL_RenderClear(render);
+      //2.复制纹理到渲染目标
+      auto ret2 = SDL_RenderCopy(render, texture, rect, rect);
+      if(ret2 < 0)
       {
-        audio_buf_size = 1024;
-        memset(audio_buf, 0, audio_buf_size);
+        std::cerr << "复制纹理失败" << std::endl;
+        quit();
+        return;
       }
-      else
+    }
+    //转换上传花掉了时间,重新计算实际需要等待的时间
+    time = monotonic_now();
+    actual_delay = frame_timer - time;
+    if(actual_delay > 0)
+    {
+      //先睡眠再自旋,把显示时间误差控制在亚毫秒级;睡眠中quit()了就不再显示
+      time = sleep_until_or_quit(frame_timer);
+      if(std::isnan(time))
       {
-        audio_buf_size = audio_size;
+        vFrame_pool.release(frame);
+        break;
       }
-      audio_buf_index = 0;
-      av_frame_free(&frame);
+      //记录实际显示时间和目标时间的误差
+      metrics.present_error.record((int64_t)(std::fabs(time - frame_timer) * 1e9));
+    }
+    else if(actual_delay < -duration)
+    {
+      //已经错过了整个显示时段,但因为是最后一帧或者连续丢了太多帧,还是显示出来
+      frames_late++;
     }
-    len1 = audio_buf_size - audio_buf_index;
-    if(len1 > len)
+    
+    trace_video(pts, ref_clock, delay, actual_delay, false);
+    //3.显示画面
+    if(!options_.headless)
     {
-      len1 = len;
+      ScopedTimer timer(metrics.stage(Stage::RENDER_PRESENT));
+      SDL_RenderPresent(render);
     }
-    //将音频数据拷贝到sdl要读取的缓冲区里
-    memcpy(stream, audio_buf + audio_buf_index, len1);
-    stream += len1;
-    audio_buf_index += len1;
-    len -= len1;
+    frame_presented(pts, vf.serial);
+    //显示一帧的开销(不含等待),用指数平均平滑
+    double render_cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - render_begin).count() -
+                         (actual_delay > 0 ? actual_delay : 0);
+    render_cost_avg = render_cost_avg * 0.9 + std::max(render_cost, 0.0) * 0.1;
+    //还给对象池,只释放帧数据,外壳留着复用
+    vFrame_pool.release(frame);
+  }
+  int64_t uploads = upload_direct_count + upload_convert_count;
+  if(uploads > 0 && !options_.headless)
+  {
+    std::cout << "直接上传帧数:" << upload_direct_count << " 转换后上传帧数:" << upload_convert_count
+              << " 平均每帧上传耗时:" << std::chrono::duration<double, std::micro>(upload_time).count() / uploads
+              << "us" << std::endl;
+  }
+  if(upload_convert_count > 0)
+  {
+    const Histogram &h = metrics.stage(Stage::SWS_SCALE);
+    std::cout << "格式转换平均耗时:" << h.mean() / 1000 << "us p99:" << h.percentile(0.99) / 1000
+              << "us 最大耗时:" << h.max() / 1000 << "us" << std::endl;
+  }
+  if(metrics.present_error.count() > 0)
+  {
+    const Histogram &h = metrics.present_error;
+    std::cout << "显示时间误差 p50:" << h.percentile(0.5) / 1000 << "us p99:" << h.percentile(0.99) / 1000
+              << "us 最大:" << h.max() / 1000 << "us" << std::endl;
+  }
+  if(frames_dropped > 0 || frames_late > 0)
+  {
+    std::cout << "丢弃的迟到帧:" << frames_dropped << " 迟到仍显示的帧:" << frames_late << std::endl;
+  }
+  if(metrics.av_drift.count() > 0)
+  {
+    const Histogram &h = metrics.av_drift;
+    std::cout << "音视频偏差 p50:" << h.percentile(0.5) / 1000000.0 << "ms p99:" << h.percentile(0.99) / 1000000.0
+              << "ms 重采样补偿帧数:" << audio_compensated_frames << " 直接转换的音频帧数:" << audio_fast_frames
+              << std::endl;
   }
+  video_sink_cpu = thread_cpu_seconds();
+  std::cout << "视频播放结束" << std::endl;
 }
-
  
-int MediaPlayer::packet_queue_put()  {
+bool MediaPlayer::accept_frame(Frame &vf)  {
+  //seek之前解码出来的帧不再显示
+  if(vf.serial != serial)
+  {
+    vFrame_pool.release(vf.frame);
+    return false;
+  }
+  if(vf.serial != frame_serial)
+  {
+    //seek之后的第一帧,从现在重新开始计时
+    frame_serial = vf.serial;
+    frame_timer = monotonic_now();
+    frame_last_pts = vf.pts;
+  }
+  return true;
+}
 
-  AVPacket *pkt = av_packet_alloc();
-  if(av_packet_ref(pkt, packet) < 0)
+bool MediaPlayer::scrub()  {
+  int steps = step_req.exchange(0);
+  bool reverse = reverse_req;
+  if(!scrubbing)
   {
-    std::cerr << "packet copy失败" << std::endl;
-    return -1;
+    resume_req = false;
+    if(steps == 0 && !reverse)
+    {
+      return false;
+    }
+    if(!enter_scrub())
+    {
+      reverse_req = false;
+      return false;
+    }
   }
-  if(pkt->stream_index == audioStreamIndex)
+  if(resume_req.exchange(false))
   {
-    std::lock_guard<std::mutex> lock(audio_Packet_mtx);
-    //缓冲队列满了，选择丢包处理
-    if(aPacket_queue.size() >= MAX_QUEUE_SIZE)
+    //从停下的画面继续播放:按精确seek解码到这一帧,继续播放后的第一帧就是停下的画面
+    scrubbing = false;
+    reverse_req = false;
+    resume_pts = scrub_pts;
+    resume_first_pts = NAN;
+    resume_serial = serial;
+    seek_accurate_req = true;
+    seek(scrub_pts, scrub_pts - shown_pts);
+    if(audio_dev)
     {
-      AVPacket *old = aPacket_queue.front();
-      aPacket_queue.pop();
-      av_packet_free(&old);
+      SDL_PauseAudioDevice(audio_dev, 0);
     }
-    aPacket_queue.push(pkt);
-    //缓冲队列新加了数据，唤醒条件变量
-    audio_Packet_cond.notify_all();
+    std::cout << "继续播放: " << scrub_pts << "s" << std::endl;
+    return false;
   }
-  else if(pkt->stream_index == videoStreamIndex)
+  double now = monotonic_now();
+  if(steps != 0)
   {
-    std::lock_guard<std::mutex> lock(video_Packet_mtx);
-    if(vPacket_queue.size() >= MAX_QUEUE_SIZE)
+    show_cached(steps);
+    reverse_next = now + frame_last_delay;
+    return true;
+  }
+  if(reverse && now >= reverse_next)
+  {
+    //按正常的帧间隔往回放,落后了不追赶;到了文件开头就停下
+    reverse_next = std::max(reverse_next + frame_last_delay, now);
+    if(!show_cached(-1))
     {
-      AVPacket *old = vPacket_queue.front();
-      vPacket_queue.pop();
-      av_packet_free(&old);
+      reverse_req = false;
     }
-    vPacket_queue.push(pkt); 
-    video_Packet_cond.notify_all();
+    return true;
   }
-  return 0;
-}
- 
-int MediaPlayer::decode_packet(AVCodecContext* codecCtx, AVPacket* packet)  {
-  //将数据包放入解码器解码
-  int ret = avcodec_send_packet(codecCtx, packet);
-  if(ret < 0)
+  //没有请求时等一会再处理事件,倒放时等到下一帧的时间
+  double wake = now + std::chrono::duration<double>(EVENT_POLL_INTERVAL).count();
+  if(reverse)
   {
-    std::cerr << "提交数据包到解码器失败:" << av_err2str(ret) << std::endl;
-    return -1;
+    wake = std::min(wake, reverse_next);
   }
-  while(ret >= 0)
+  uint32_t seq = quit_event.prepare_wait();
+  if(is_close)
   {
-    double pts = 0;
-    AVFrame *frame = av_frame_alloc();
-    //解码后的数据从这个函数中读取,放入frame里(一帧一帧的读)
-    ret = avcodec_receive_frame(codecCtx, frame);
-    if(ret < 0)
+    quit_event.cancel_wait();
+    return true;
+  }
+  quit_event.wait(seq, std::chrono::milliseconds((int64_t)std::ceil((wake - now) * 1000)));
+  return true;
+}
+
+bool MediaPlayer::enter_scrub()  {
+  if(!gop_cache_ready)
+  {
+    if(options_.gop_cache_bytes == 0 || options_.live || !vStream)
     {
-      //这两种情况不是发生了解码错误,所以不退出
-      if(ret == AVERROR_EOF || ret == AVERROR(EAGAIN))
-      {
-        //std::cerr << "没有可用的解码后的视频数据可读了" << std::endl;
-        break;
-      }
-      //其它情况直接退出
-      std::cerr << "解码过程出现错误" << av_err2str(ret) << std::endl;
-      av_frame_free(&frame);
-      return -1;
+      return false;
     }
-    if(codecCtx->codec->type == AVMEDIA_TYPE_VIDEO)
+    gop_cache.reset(new GopCache(url_, pCodec, vStream->codecpar, pCodecCtx->lowres, options_.decode_threads,
+                                 index_ready ? keyframe_index.get() : nullptr, options_.gop_cache_bytes,
+                                 options_.mmap_io));
+    if(!gop_cache->is_opened())
     {
-      std::lock_guard<std::mutex> lock(video_Frame_mtx);
-      if(vFrame_queue.size() > MAX_QUEUE_SIZE)
-      {
-        //缓冲队列过大，丢帧处理
-        AVFrame *old = vFrame_queue.front().frame;
-        vFrame_queue.pop();
-        av_frame_free(&old);
-      }
-      //获取pts,如果dts不存在但是opaque里有则用opaque里的值。不然就是dts,都没有就为0
-      if(packet->dts == AV_NOPTS_VALUE && frame->opaque && (int64_t)frame->opaque != AV_NOPTS_VALUE)
-      {
-        //将opaqueue强转为int64_t类型的指针然后取值
-        pts = *(int64_t*)frame->opaque; 
-      }
-      else if(packet->dts != AV_NOPTS_VALUE)
+      gop_cache.reset();
+      return false;
+    }
+    scrub_frame = av_frame_alloc();
+    gop_cache_ready = true;
+  }
+  scrubbing = true;
+  //从正在显示的画面开始移动;frame_last_pts可能是刚丢掉的迟到帧,用真正显示出来的那一帧
+  scrub_pts = shown_pts;
+  reverse_next = monotonic_now();
+  if(audio_dev)
+  {
+    SDL_PauseAudioDevice(audio_dev, 1);
+  }
+  std::cout << "进入逐帧模式: " << scrub_pts << "s" << std::endl;
+  return true;
+}
+
+bool MediaPlayer::show_cached(int offset)  {
+  av_frame_unref(scrub_frame);
+  Frame f{scrub_frame, scrub_pts};
+  if(!gop_cache->frame_at(scrub_pts, offset, f))
+  {
+    return false;
+  }
+  bool moved = f.pts != scrub_pts;
+  scrub_pts = f.pts;
+  if(options_.headless)
+  {
+    return convert_frame(scrub_frame) != NULL && moved;
+  }
+  if(upload_frame(scrub_frame) < 0)
+  {
+    return false;
+  }
+  SDL_RenderClear(render);
+  SDL_RenderCopy(render, texture, rect, rect);
+  SDL_RenderPresent(render);
+  return moved;
+}
+
+bool MediaPlayer::present_unpaced(Frame &vf)  {
+  if(convert_frame(vf.frame) == NULL)
+  {
+    return false;
+  }
+  frame_presented(vf.pts, vf.serial);
+  vFrame_pool.release(vf.frame);
+  return true;
+}
+
+//记录一帧的同步参数,ref_clock是showFrame里同步用的主时钟(视频为主时没有取,为NAN)
+void MediaPlayer::trace_video(double pts, double ref_clock, double delay, double actual_delay, bool dropped)  {
+  SyncTrace *trace = options_.sync_trace;
+  if(!trace)
+  {
+    return;
+  }
+  double master = std::isnan(ref_clock) ? get_master_clock() : ref_clock;
+  trace->add_video({trace->elapsed(), pts, master, pts - master, pts - get_audio_clock(), delay, actual_delay, dropped});
+}
+
+//画面显示出来了,更新视频时钟;外部时钟跟随音频时钟(还没有音频时跟随视频时钟)
+void MediaPlayer::frame_presented(double pts, int serial)  {
+  //seek之后显示的第一帧,记录seek的耗时
+  if(serial != vidclk.serial() && serial > 0)
+  {
+    metrics.seek_latency.record((int64_t)((monotonic_now() - seek_request_time) * 1e9));
+  }
+  vidclk.set(pts, serial);
+  shown_pts = pts;
+  //从步进/倒放继续播放后显示的第一帧
+  if(!std::isnan(resume_pts) && std::isnan(resume_first_pts) && serial != resume_serial)
+  {
+    resume_first_pts = pts;
+  }
+  if(std::isnan(first_frame_time))
+  {
+    first_frame_time = monotonic_now();
+  }
+  double audio = get_audio_clock();
+  //精确seek之后新位置的画面和声音都出来了,目标之前的帧已经丢完,清掉目标时间;
+  //比较交换,刚好又来一次seek写了新的目标时就不动它
+  double target = seek_target;
+  if(!std::isnan(target) && serial == this->serial && !std::isnan(audio))
+  {
+    seek_target.compare_exchange_strong(target, NAN);
+  }
+  if(!std::isnan(audio))
+  {
+    metrics.av_drift.record((int64_t)(std::fabs(audio - pts) * 1e9));
+  }
+  //直播模式下外部时钟由readData控制,不跟随音视频时钟
+  if(!options_.live)
+  {
+    extclk.sync_to_slave(std::isnan(audio) ? vidclk : audclk, AV_NOSYNC_THRESHOLD);
+  }
+  rendered_frames++;
+}
+
+//把解码后的帧上传到IYUV纹理
+//解码器输出已经是YUV420P时直接上传解码器的三个平面,只有格式或尺寸不一致时才走sws_scale
+int MediaPlayer::upload_frame(AVFrame *frame)  {
+  auto begin = std::chrono::steady_clock::now();
+  AVFrame *yuv = convert_frame(frame);
+  if(!yuv)
+  {
+    return -1;
+  }
+  //三个平面分别上传,不要求平面在内存里连续
+  int ret;
+  {
+    ScopedTimer timer(metrics.stage(Stage::UPDATE_TEXTURE));
+    ret = SDL_UpdateYUVTexture(texture, rect, yuv->data[0], yuv->linesize[0], yuv->data[1], yuv->linesize[1], yuv->data[2], yuv->linesize[2]);
+  }
+  if(ret < 0)
+  {
+    std::cerr << "更新纹理失败" << std::endl;
+    return -1;
+  }
+  upload_time += std::chrono::steady_clock::now() - begin;
+  return 0;
+}
+
+//返回可以直接上传到IYUV纹理的帧,解码器输出已经符合要求时原样返回,否则转换到pFrameYUV
+//YUVJ420P是全范围的,IYUV纹理按有限范围显示,直接上传颜色会发灰,仍然交给sws转换
+AVFrame *MediaPlayer::convert_frame(AVFrame *frame)  {
+  bool direct = frame->format == AV_PIX_FMT_YUV420P &&
+                frame->width == pFrameYUV->width && frame->height == pFrameYUV->height;
+  if(direct)
+  {
+    upload_direct_count++;
+    return frame;
+  }
+  else
+  {
+    //格式或尺寸变化时重新创建上下文,否则直接复用
+    if(!sws_ctx || frame->width != sws_src_width || frame->height != sws_src_height || frame->format != sws_src_format)
+    {
+      sws_freeContext(sws_ctx);
+      sws_ctx = create_sws_context(frame);
+      if(!sws_ctx)
+      {
+        std::cerr << "创建视频转换上下文失败" << std::endl;
+        return NULL;
+      }
+    }
+    //将像素格式转换为我们想要的
+    //sws_scale_frame会把图像切成水平的条带分给swscale内部的线程池并行转换
+    int ret;
+    {
+      ScopedTimer timer(metrics.stage(Stage::SWS_SCALE));
+      ret = sws_scale_frame(sws_ctx, pFrameYUV, frame);
+    }
+    if(ret < 0)
+    {
+      std::cerr << "视频转换格式失败" << std::endl;
+      return NULL;
+    }
+    upload_convert_count++;
+    return pFrameYUV;
+  }
+}
+
+//创建支持条带并行的转换上下文
+//sws_getContext创建的上下文只会单线程转换,这里用AVOption设置threads后再初始化
+SwsContext *MediaPlayer::create_sws_context(const AVFrame *frame)  {
+  int threads = options_.convert_threads;
+  if(threads <= 0)
+  {
+    threads = options_.executor ? 1 : std::min<int>(std::thread::hardware_concurrency(), MAX_CONVERT_THREADS);
+  }
+  SwsContext *ctx = sws_alloc_context();
+  if(!ctx)
+  {
+    return NULL;
+  }
+  av_opt_set_int(ctx, "srcw", frame->width, 0);
+  av_opt_set_int(ctx, "srch", frame->height, 0);
+  av_opt_set_int(ctx, "src_format", frame->format, 0);
+  av_opt_set_int(ctx, "dstw", pFrameYUV->width, 0);
+  av_opt_set_int(ctx, "dsth", pFrameYUV->height, 0);
+  av_opt_set_int(ctx, "dst_format", AV_PIX_FMT_YUV420P, 0);
+  av_opt_set_int(ctx, "sws_flags", SWS_BILINEAR, 0);
+  av_opt_set_int(ctx, "threads", threads, 0);
+  if(sws_init_context(ctx, NULL, NULL) < 0)
+  {
+    sws_freeContext(ctx);
+    return NULL;
+  }
+  sws_src_width = frame->width;
+  sws_src_height = frame->height;
+  sws_src_format = frame->format;
+  std::cout << "像素格式转换: " << av_get_pix_fmt_name((AVPixelFormat)frame->format) << " -> yuv420p, 线程数:" << threads << std::endl;
+  return ctx;
+}
+
+void MediaPlayer::choose_output_size()  {
+  int width = pCodecCtx->width;
+  int height = pCodecCtx->height;
+  out_width = width;
+  out_height = height;
+  if(options_.output_width <= 0 && options_.output_height <= 0)
+  {
+    return;
+  }
+  //按显示比例(考虑像素宽高比)算另一边
+  double aspect = (double)width / height;
+  AVRational sar = av_guess_sample_aspect_ratio(pFormatCtx, vStream, NULL);
+  if(sar.num > 0 && sar.den > 0)
+  {
+    aspect *= av_q2d(sar);
+  }
+  int w = options_.output_width;
+  int h = options_.output_height;
+  if(w > 0 && h > 0)
+  {
+    if(w / aspect <= h)
+    {
+      h = (int)lrint(w / aspect);
+    }
+    else
+    {
+      w = (int)lrint(h * aspect);
+    }
+  }
+  else if(w > 0)
+  {
+    h = (int)lrint(w / aspect);
+  }
+  else
+  {
+    w = (int)lrint(h * aspect);
+  }
+  //yuv420要求宽高都是偶数
+  out_width = std::max(2, w & ~1);
+  out_height = std::max(2, h & ~1);
+
+  //lowres每加一级解码输出的宽高减半,取解码输出仍然不小于输出大小的最大一级,之后格式转换只做剩下的缩放
+  //只有mjpeg等少数解码器支持,h264/hevc的max_lowres是0
+  int lowres = 0;
+  while(lowres < pCodec->max_lowres && (width >> (lowres + 1)) >= out_width && (height >> (lowres + 1)) >= out_height)
+  {
+    lowres++;
+  }
+  pCodecCtx->lowres = lowres;
+  std::cout << "输出大小: " << out_width << "x" << out_height << " 解码lowres:" << lowres << "(解码输出"
+            << (width >> lowres) << "x" << (height >> lowres) << ")" << std::endl;
+}
+
+//打印解码器实际使用的线程模式
+void MediaPlayer::print_decode_threading()  {
+  const char *type = "单线程";
+  if(pCodecCtx->active_thread_type & FF_THREAD_FRAME)
+  {
+    type = "帧线程";
+  }
+  else if(pCodecCtx->active_thread_type & FF_THREAD_SLICE)
+  {
+    type = "片线程";
+  }
+  std::cout << "视频解码线程: " << type << " 线程数:" << pCodecCtx->thread_count << std::endl;
+  if(pCodecCtx->active_thread_type & FF_THREAD_FRAME)
+  {
+    //帧线程时每个线程手上都压着一帧,第一帧要等所有线程都拿到数据后才会输出
+    double frame_duration = vStream->avg_frame_rate.num > 0 ? av_q2d(av_inv_q(vStream->avg_frame_rate)) : frame_last_delay;
+    int extra_frames = pCodecCtx->thread_count - 1;
+    std::cout << "帧线程额外延迟: " << extra_frames << "帧 约" << extra_frames * frame_duration * 1000 << "ms" << std::endl;
+  }
+}
+
+//初始化sdl
+void MediaPlayer::sdl_init()  {
+  //1.初始化视频子系统,声卡在open_audio_device里单独初始化
+  if(SDL_InitSubSystem(SDL_INIT_VIDEO) != 0)
+  {
+    std::cerr << "初始化sdl视频失败:" << SDL_GetError() << std::endl;
+    return;
+  }
+  sdl_video_inited = true;
+
+  //2.创建窗口
+  //创建一个标题为Video,窗口坐标在中间的宽高和视频一样的窗口
+  window = SDL_CreateWindow("Video", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, out_width, out_height, SDL_WINDOW_SHOWN);
+  if(!window)
+  {
+    std::cerr << "创建sdl窗口失败" << std::endl;
+    return;
+  }
+  //3.创建渲染器
+  //初始化默认的渲染设备，使用软件渲染,和显示器的刷新率同步
+  render = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+  if(!render)
+  {
+    std::cerr << "创建sdl渲染器失败" << std::endl;
+    return;
+  }
+  //4.创建纹理
+  //纹理和输出一样大,不再按视频的原始分辨率上传
+  texture = SDL_CreateTexture(render, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, out_width, out_height);
+  if(!texture)
+  {
+    std::cerr << "创建sdl纹理失败" << std::endl;
+    return;
+  }
+
+}
+
+int MediaPlayer::interruptCallback(void *opaque) {
+  return ((MediaPlayer *)opaque)->is_close ? 1 : 0;
+}
+
+void MediaPlayer::audioCallback(void *userdata, Uint8 *stream, int len) {
+  MediaPlayer* m = (MediaPlayer *)userdata;
+  ScopedTimer timer(m->metrics.stage(Stage::AUDIO_CALLBACK));
+  m->audioDataRead(m->aCodecCtx, stream, len);
+}
+
+//音频回调函数
+//运行在sdl的实时音频线程里,只从环形缓冲区memcpy,不加锁不分配内存,数据不够就补静音
+void MediaPlayer::audioDataRead(void *userdata, Uint8 *stream, int len) {
+  AVCodecContext *aCodecCtx = (AVCodecContext *)userdata;
+  double callback_time = monotonic_now();
+  //跳过seek之前的旧数据:旧serial的帧整段跳过,新serial第一帧之前没有标记的半截数据也跳过
+  int cur_serial = serial;
+  PcmMark *next = NULL;
+  while((next = pcm_marks.front()) != NULL && next->serial != cur_serial)
+  {
+    uint64_t consumed = pcm_ring->consumed();
+    if(consumed < next->end_offset)
+    {
+      pcm_ring->skip(next->end_offset - consumed);
+    }
+    PcmMark stale;
+    pcm_marks.try_pop(stale);
+  }
+  if(next != NULL && pcm_ring->consumed() < next->start_offset)
+  {
+    pcm_ring->skip(next->start_offset - pcm_ring->consumed());
+  }
+  else if(next == NULL && has_mark && last_mark.serial != cur_serial)
+  {
+    //新位置的数据还没到,缓冲区里剩下的都是旧数据
+    pcm_ring->skip(pcm_ring->size());
+  }
+  size_t n = pcm_ring->read(stream, len);
+  if(n < (size_t)len)
+  {
+    memset(stream + n, 0, len - n);
+  }
+  if(n > 0 && std::isnan(first_audio_time))
+  {
+    first_audio_time = callback_time;
+  }
+  //找到读位置所在的那一帧,由它的结束pts倒推读位置的pts
+  uint64_t offset = pcm_ring->consumed();
+  while((next = pcm_marks.front()) != NULL && next->end_offset <= offset)
+  {
+    pcm_marks.try_pop(last_mark);
+    has_mark = true;
+  }
+  int bytes_per_sec = aCodecCtx->sample_rate * aCodecCtx->ch_layout.nb_channels * 2;
+  double pts;
+  int clock_serial;
+  if(next != NULL)
+  {
+    pts = next->end_pts - (double)(next->end_offset - offset) / bytes_per_sec;
+    clock_serial = next->serial;
+  }
+  else if(has_mark && last_mark.serial == cur_serial)
+  {
+    pts = last_mark.end_pts + (double)(offset - last_mark.end_offset) / bytes_per_sec;
+    clock_serial = last_mark.serial;
+  }
+  else
+  {
+    //还没有任何数据送出去,时钟保持未设置
+    return;
+  }
+  //声卡里还压着两个缓冲区的数据,减掉它们的时长就是回调发生时正在播放的位置
+  audclk.set_at(pts - 2.0 * spec.size / bytes_per_sec, clock_serial, callback_time);
+}
+
+ 
+int MediaPlayer::packet_queue_put()  {
+
+  PacketQueue *q = NULL;
+  PacketPool *pool = NULL;
+  if(packet->stream_index == audioStreamIndex)
+  {
+    q = &aPacket_queue;
+    pool = &aPacket_pool;
+  }
+  else if(packet->stream_index == videoStreamIndex)
+  {
+    q = &vPacket_queue;
+    pool = &vPacket_pool;
+  }
+  else
+  {
+    return 0;
+  }
+  //从池子里拿一个空的packet外壳,直接把数据的引用移动过去,不再拷贝/增加引用计数
+  AVPacket *pkt = pool->acquire();
+  if(!pkt)
+  {
+    std::cerr << "分配packet失败" << std::endl;
+    return -1;
+  }
+  av_packet_move_ref(pkt, packet);
+  AVStream *st = pkt->stream_index == audioStreamIndex ? aStream : vStream;
+  double duration = pkt->duration * av_q2d(st->time_base);
+  //flv之类的格式经常不带包时长,按帧率/每帧采样数估算
+  if(duration <= 0)
+  {
+    if(st == vStream && vStream->avg_frame_rate.num > 0)
+    {
+      duration = av_q2d(av_inv_q(vStream->avg_frame_rate));
+    }
+    else if(st == aStream && aCodecCtx->frame_size > 0)
+    {
+      duration = (double)aCodecCtx->frame_size / aCodecCtx->sample_rate;
+    }
+  }
+  //执行器上不能阻塞,demux_step在读包之前已经检查过上限(包括槽位),这里一定放得进去
+  if(options_.executor)
+  {
+    q->try_push({pkt, serial}, pkt->size, duration);
+    return 0;
+  }
+  //缓冲队列超过字节/时长上限就等待解码线程取走数据,push内部只在队列由空变为非空时才唤醒解码线程
+  while(!q->push({pkt, serial}, pkt->size, duration, QUEUE_PUSH_TIMEOUT))
+  {
+    if(is_close)
+    {
+      av_packet_free(&pkt);
+      return -1;
+    }
+    //有seek请求,这个包已经没用了,不再等待
+    if(seek_req)
+    {
+      pool->put_back(pkt);
+      return 0;
+    }
+  }
+  return 0;
+}
+ 
+int MediaPlayer::decode_packet(AVCodecContext* codecCtx, AVPacket* packet, int serial)  {
+  //将数据包放入解码器解码
+  int ret;
+  {
+    ScopedTimer timer(metrics.stage(Stage::SEND_PACKET));
+    ret = avcodec_send_packet(codecCtx, packet);
+  }
+  if(ret < 0)
+  {
+    std::cerr << "提交数据包到解码器失败:" << av_err2str(ret) << std::endl;
+    return -1;
+  }
+  if(codecCtx == pCodecCtx && packet)
+  {
+    video_packets_sent++;
+  }
+  FramePool &pool = codecCtx == pCodecCtx ? vFrame_pool : aFrame_pool;
+  while(ret >= 0)
+  {
+    double pts = 0;
+    AVFrame *frame = pool.acquire();
+    //解码后的数据从这个函数中读取,放入frame里(一帧一帧的读)
+    {
+      ScopedTimer timer(metrics.stage(Stage::RECEIVE_FRAME));
+      ret = avcodec_receive_frame(codecCtx, frame);
+    }
+    if(ret < 0)
+    {
+      //没用上的帧还回池子,下次接着用
+      pool.put_back(frame);
+      //这两种情况不是发生了解码错误,所以不退出
+      if(ret == AVERROR_EOF || ret == AVERROR(EAGAIN))
+      {
+        //std::cerr << "没有可用的解码后的视频数据可读了" << std::endl;
+        break;
+      }
+      //其它情况直接退出
+      std::cerr << "解码过程出现错误" << av_err2str(ret) << std::endl;
+      return -1;
+    }
+    decoded_frames++;
+    if(!packet)
+    {
+      drained_frames++;
+    }
+    //记录解码器吐出第一帧视频前已经送进去了多少个包,即实测的解码延迟
+    if(codecCtx == pCodecCtx && first_video_frame_packets < 0)
+    {
+      first_video_frame_packets = video_packets_sent;
+      std::cout << "视频解码首帧延迟: " << first_video_frame_packets << "个包" << std::endl;
+    }
+    FrameQueue *q = NULL;
+    Frame item;
+    int64_t bytes = 0;
+    double duration = 0;
+    if(codecCtx->codec->type == AVMEDIA_TYPE_VIDEO)
+    {
+      //用解码器给这一帧推算的时间戳,不用刚送进去的包的dts:帧线程时解码器吐出的帧是thread_count-1个包之前送进去的,
+      //包的dts属于后面的帧;GOP缓存也用frame_pts,两边的时间一致
+      pts = frame_pts(frame, vStream->time_base);
+      //时间戳不存在但是opaque里有则用opaque里的值,都没有就为0
+      if(std::isnan(pts))
+      {
+        //将opaqueue强转为int64_t类型的指针然后取值
+        bool has_opaque = frame->opaque && (int64_t)frame->opaque != AV_NOPTS_VALUE;
+        pts = has_opaque ? *(int64_t*)frame->opaque * av_q2d(vStream->time_base) : 0;
+      }
+      pts = synchronize_video(frame, pts);//处理一下pts
+      q = &vFrame_queue;
+      item = {frame, pts, 0, serial};
+      bytes = av_image_get_buffer_size((AVPixelFormat)frame->format, frame->width, frame->height, 1);
+      //解码帧没有可靠的时长,用平均帧率估算
+      duration = vStream->avg_frame_rate.num > 0 ? av_q2d(av_inv_q(vStream->avg_frame_rate)) : frame_last_delay;
+      //精确seek:目标时间之前的帧解码出来就丢掉,不是精确seek时seek_target为NAN
+      if(pts + duration <= seek_target + SEEK_PTS_EPSILON)
+      {
+        pool.put_back(frame);
+        continue;
+      }
+      //直播追赶时解码出来就已经过时的帧不再送给渲染线程
+      if(options_.live && pts + duration < get_master_clock() - AV_SYNC_THRESHOLD_MAX)
+      {
+        frames_dropped++;
+        pool.put_back(frame);
+        continue;
+      }
+    }
+    else if(codecCtx->codec->type == AVMEDIA_TYPE_AUDIO)
+    {
+      int64_t ts = packet ? packet->pts : frame->pts;
+      if(ts != AV_NOPTS_VALUE)
+      {
+        pts = ts * av_q2d(aStream->time_base);
+      }
+      //音频帧不经过帧队列,在解码线程里直接重采样写入环形缓冲区
+      double frame_duration = (double)frame->nb_samples / aCodecCtx->sample_rate;
+      if(pts + frame_duration <= seek_target + SEEK_PTS_EPSILON)
+      {
+        pool.release(frame);
+        continue;
+      }
+      //直播追赶时已经过时的音频直接丢掉,落后太多靠重采样补偿追不上
+      if(options_.live && pts + frame_duration < get_master_clock() - AV_SYNC_THRESHOLD_MAX)
+      {
+        pool.release(frame);
+        continue;
+      }
+      int ret2 = write_audio_frame(frame, pts, serial);
+      pool.release(frame);
+      if(ret2 < 0)
+      {
+        return -1;
+      }
+      continue;
+    }
+    else
+    {
+      pool.put_back(frame);
+      continue;
+    }
+    if(options_.executor)
+    {
+      //video_decode_step在解码之前已经检查过上限,但一个包(特别是冲解码器时)可能解出好几帧
+      queue_frame(item, bytes, duration);
+      continue;
+    }
+    //帧队列超过上限就等待消费者,不再丢弃旧帧
+    while(!q->push(item, bytes, duration, QUEUE_PUSH_TIMEOUT))
+    {
+      if(is_close)
+      {
+        av_frame_free(&frame);
+        return -1;
+      }
+      //已经seek了,这一帧不用再送出去
+      if(serial != this->serial)
+      {
+        pool.put_back(frame);
+        return 0;
+      }
+    }
+  }
+  return 0;
+}
+
+int MediaPlayer::write_audio_frame(AVFrame *frame, double pts, int serial)  {
+  int channels = aCodecCtx->ch_layout.nb_channels;
+  int bytes_per_sample = 2 * channels;
+  //这一帧播放完时的pts
+  double end_pts = pts + (double)frame->nb_samples / aCodecCtx->sample_rate;
+  int wanted_nb_samples = synchronize_audio(frame->nb_samples);
+  if(wanted_nb_samples != frame->nb_samples)
+  {
+    //在这一帧的时长里平滑地多出/少掉这些采样,不会有复制采样点带来的爆音
+    if(swr_set_compensation(swr_ctx, wanted_nb_samples - frame->nb_samples, wanted_nb_samples) < 0)
+    {
+      std::cerr << "设置重采样补偿失败" << std::endl;
+      return -1;
+    }
+    audio_compensated_frames++;
+  }
+  bool compensating = wanted_nb_samples != frame->nb_samples;
+  swr_idle_frames = compensating ? 0 : std::min(swr_idle_frames + 1, SWR_FAST_PATH_HOLD);
+  //不需要伸缩采样数、格式也和打开时一样,直接转换,不经过swr;
+  //补偿结束后先留在swr上,连续SWR_FAST_PATH_HOLD帧都不需要补偿再切回来,免得同步时来回切换
+  bool fast = audio_converter.func && !compensating && frame->format == aCodecCtx->sample_fmt &&
+              (!swr_active || swr_idle_frames >= SWR_FAST_PATH_HOLD);
+  //从swr切回直接转换的这一帧:swr的输出比输入晚delay个采样,这一帧照常经过swr,
+  //再把最后delay个采样直接转换接在后面,输出是连续的,不冲swr(冲的时候会补零)也不重置swr
+  int tail = frame->nb_samples;
+  if(fast && swr_active)
+  {
+    tail = (int)std::min<int64_t>(swr_get_delay(swr_ctx, aCodecCtx->sample_rate), frame->nb_samples);
+    swr_stale_samples = tail;
+    swr_active = false;
+  }
+  else if(!fast && !swr_active)
+  {
+    //上次切走时swr里留下的采样已经直接转换输出过了,重新进入swr时丢掉
+    if(swr_stale_samples > 0 && swr_drop_output(swr_ctx, swr_stale_samples) < 0)
+    {
+      std::cerr << "丢弃重采样缓存失败" << std::endl;
+      return -1;
+    }
+    swr_stale_samples = 0;
+    swr_active = true;
+  }
+  //输出缓冲区按补偿后的采样数再留一点余量(也够放切换时直接转换接在后面的采样),大小稳定后不再分配
+  int max_samples = swr_get_out_samples(swr_ctx, wanted_nb_samples) + 256;
+  av_fast_malloc(&audio_buf, &audio_buf_alloc, (max_samples + frame->nb_samples) * bytes_per_sample);
+  if(!audio_buf)
+  {
+    std::cerr << "分配音频缓冲区失败" << std::endl;
+    return -1;
+  }
+  int out_samples = 0;
+  if(!fast || tail < frame->nb_samples)
+  {
+    out_samples = swr_convert(swr_ctx, &audio_buf, max_samples, (const uint8_t **)frame->extended_data, frame->nb_samples);
+  }
+  if(out_samples < 0)
+  {
+    std::cerr << "音频重采样失败:" << av_err2str(out_samples) << std::endl;
+    return -1;
+  }
+  if(out_samples > 0 && swr_gain.func)
+  {
+    swr_gain.func(&audio_buf, (int16_t *)audio_buf, out_samples, channels, options_.audio_gain);
+  }
+  if(fast && tail > 0)
+  {
+    //只转换这一帧最后tail个采样,planar格式每个声道各自偏移,packed格式只有一个指针
+    int skip = frame->nb_samples - tail;
+    int sample_size = av_get_bytes_per_sample((AVSampleFormat)frame->format);
+    bool planar = av_sample_fmt_is_planar((AVSampleFormat)frame->format);
+    std::vector<const uint8_t *> in(planar ? channels : 1);
+    for(size_t i = 0; i < in.size(); i++)
+    {
+      in[i] = frame->extended_data[i] + (size_t)skip * sample_size * (planar ? 1 : channels);
+    }
+    audio_converter.func(in.data(), (int16_t *)audio_buf + out_samples * channels, tail, channels, options_.audio_gain);
+    out_samples += tail;
+    audio_fast_frames++;
+  }
+  audio_samples += out_samples;
+  int audio_size = out_samples * bytes_per_sample;
+  //缓冲区满了就等声卡消费,声卡(或null_audio_sink)会一直读到数据取完,所以这里不会永久阻塞
+  const uint8_t *data = audio_buf;
+  size_t left = audio_size;
+  uint64_t start_offset = pcm_ring->written();
+  while(left > 0)
+  {
+    uint64_t before = pcm_ring->written();
+    pcm_ring->write_all(data, left, QUEUE_PUSH_TIMEOUT);
+    size_t n = pcm_ring->written() - before;
+    data += n;
+    left -= n;
+    //seek了就不再等声卡,写了一半的数据没有标记,音频回调会跳过它
+    if(left > 0 && serial != this->serial)
+    {
+      return 0;
+    }
+    if(left > 0 && is_close)
+    {
+      return -1;
+    }
+  }
+  pcm_marks.try_push({start_offset, pcm_ring->written(), end_pts, serial});
+  uint64_t level = pcm_ring->size();
+  if(level > pcm_high_water)
+  {
+    pcm_high_water = level;
+  }
+  return 0;
+}
+ 
+void MediaPlayer::video_thread()  {
+
+  while(!is_close)
+  {
+    Packet p;
+    //阻塞直到有新数据进来,解码时不持有任何锁,readData不会被解码拖住
+    if(!vPacket_queue.pop(p, QUEUE_POP_TIMEOUT))
+    {
+      continue;//超时或者quit()关闭了队列,回到循环开头检查
+    }
+    //结束标记,冲完解码器后接着等,之后可能还会seek
+    if(!p.pkt)
+    {
+      video_eof(p.serial);
+      continue;
+    }
+    video_packet(p);
+  }
+  video_decode_done = true;
+  video_decode_cpu = thread_cpu_seconds();
+  std::cout << "视频解码结束" << std::endl;
+}
+
+void MediaPlayer::video_packet(Packet &p)  {
+  //seek之前的旧包直接丢掉
+  if(p.serial != serial)
+  {
+    vPacket_pool.release(p.pkt);
+    return;
+  }
+  //seek之后的第一个包,清空解码器里缓存的参考帧
+  if(p.serial != video_decoder_serial)
+  {
+    avcodec_flush_buffers(pCodecCtx);
+    video_decoder_serial = p.serial;
+    video_clock = 0;
+  }
+  if(options_.live)
+  {
+    //已经落后于主时钟的包只解码参考帧,非参考帧解出来也来不及显示
+    double clock = get_master_clock();
+    int64_t ts = p.pkt->pts != AV_NOPTS_VALUE ? p.pkt->pts : p.pkt->dts;
+    bool late = !std::isnan(clock) && ts != AV_NOPTS_VALUE && ts * av_q2d(vStream->time_base) < clock;
+    pCodecCtx->skip_frame = late ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+  }
+  //解码并放到帧队列
+  decode_packet(pCodecCtx, p.pkt, p.serial);
+  vPacket_pool.release(p.pkt);
+}
+
+void MediaPlayer::video_eof(int serial)  {
+  //送一个空包让解码器把重排缓冲里剩下的帧都吐出来;结束标记是seek之前的就没什么可冲的
+  if(serial == this->serial && serial == video_decoder_serial)
+  {
+    pCodecCtx->skip_frame = AVDISCARD_DEFAULT;
+    decode_packet(pCodecCtx, NULL, serial);
+  }
+  Frame eof{NULL, 0, 0, serial};
+  if(options_.executor)
+  {
+    //排在冲出来的帧后面
+    queue_frame(eof, 0, 0);
+    return;
+  }
+  while(!vFrame_queue.push(eof, 0, 0, QUEUE_PUSH_TIMEOUT))
+  {
+    if(is_close)
+    {
+      return;
+    }
+  }
+}
+
+ 
+void MediaPlayer::audio_thread()  {
+
+  while(!is_close)
+  {
+    Packet p;
+    //阻塞直到有新数据进来(最多等待1000ms)
+    if(!aPacket_queue.pop(p, QUEUE_POP_TIMEOUT))
+    {
+      continue;
+    }
+    if(!p.pkt)
+    {
+      audio_eof(p.serial);
+      continue;
+    }
+    audio_packet(p);
+  }
+  audio_decode_done = true;
+  pcm_ring->close();
+  audio_decode_cpu = thread_cpu_seconds();
+  std::cout << "音频解码结束" << std::endl;
+}
+
+void MediaPlayer::audio_packet(Packet &p)  {
+  if(p.serial != serial)
+  {
+    aPacket_pool.release(p.pkt);
+    return;
+  }
+  if(p.serial != audio_decoder_serial)
+  {
+    avcodec_flush_buffers(aCodecCtx);
+    audio_decoder_serial = p.serial;
+    //seek前累计的音视频误差已经没有意义了
+    audio_diff_avg_count = 0;
+    audio_diff_cum = 0;
+  }
+  decode_packet(aCodecCtx, p.pkt, p.serial);
+  aPacket_pool.release(p.pkt);
+}
+
+void MediaPlayer::queue_frame(const Frame &item, int64_t bytes, double duration)  {
+  //前面还有没放进去的帧时排在后面,保持顺序
+  if(pending_frames.empty() && vFrame_queue.try_push(item, bytes, duration))
+  {
+    return;
+  }
+  pending_frames.push_back({item, bytes, duration});
+}
+
+bool MediaPlayer::flush_pending_frames()  {
+  while(!pending_frames.empty())
+  {
+    PendingFrame &f = pending_frames.front();
+    if(!vFrame_queue.try_push(f.item, f.bytes, f.duration))
+    {
+      return false;
+    }
+    pending_frames.pop_front();
+  }
+  return true;
+}
+
+void MediaPlayer::audio_eof(int serial)  {
+  if(serial == this->serial && serial == audio_decoder_serial)
+  {
+    decode_packet(aCodecCtx, NULL, serial);
+  }
+  //PCM环形缓冲区是字节流,放不了结束标记,记下写完的serial,叫醒等数据的音频输出去判断是否已经放完
+  audio_eof_serial = serial;
+  pcm_ring->wake_all();
+}
+
+bool MediaPlayer::audio_finished() const  {
+  //先看audio_eof_serial再看是否为空,解码端是写完数据之后才设置它的
+  return (audio_decode_done || audio_eof_serial == serial) && pcm_ring->empty();
+}
+
+/*
+ * 执行器上的任务
+ * 和专用线程做的事情一样,只是不阻塞:输入为空或者输出超过上限时返回IDLE,由执行器退避后再调用
+ * 每一步最多处理EXECUTOR_STEP_BUDGET个数据,处理完返回RUNNING,让同一个工作线程上的其它播放器也能轮到
+ */
+TaskStatus MediaPlayer::demux_step()  {
+  for(int i = 0; i < EXECUTOR_STEP_BUDGET; i++)
+  {
+    if(is_close)
+    {
+      finish_demux();
+      return TaskStatus::DONE;
+    }
+    //有seek请求时先seek,旧包会被解码任务丢掉,队列很快就会空出来
+    if(seek_req)
+    {
+      do_seek();
+    }
+    //包队列满了(包括槽位用完)先让出工作线程,保证demux_one读到的包一定放得进去
+    if(vPacket_queue.over_limit() || aPacket_queue.over_limit())
+    {
+      return TaskStatus::IDLE;
+    }
+    if(!demux_one())
+    {
+      //结束标记放不进去(槽位用完了)就等解码任务取走一些再试;放进去之后等seek或者quit()
+      if(!send_eof() || !options_.live)
       {
-        pts = packet->dts;
+        return TaskStatus::IDLE;
       }
-      else
+      finish_demux();
+      return TaskStatus::DONE;
+    }
+  }
+  return TaskStatus::RUNNING;
+}
+
+TaskStatus MediaPlayer::video_decode_step()  {
+  for(int i = 0; i < EXECUTOR_STEP_BUDGET; i++)
+  {
+    //上一步没放进帧队列的帧先按顺序放进去,放完之前不再解码
+    if(!is_close && !flush_pending_frames())
+    {
+      return TaskStatus::IDLE;
+    }
+    if(is_close)
+    {
+      video_decode_done = true;
+      std::cout << "视频解码结束" << std::endl;
+      return TaskStatus::DONE;
+    }
+    if(vFrame_queue.over_limit())
+    {
+      return TaskStatus::IDLE;
+    }
+    Packet p;
+    if(!vPacket_queue.try_pop(p))
+    {
+      return TaskStatus::IDLE;
+    }
+    if(!p.pkt)
+    {
+      //放不下的帧留在pending_frames里,下一步接着放;之后可能还会seek,不结束
+      video_eof(p.serial);
+      continue;
+    }
+    video_packet(p);
+  }
+  return TaskStatus::RUNNING;
+}
+
+TaskStatus MediaPlayer::audio_decode_step()  {
+  for(int i = 0; i < EXECUTOR_STEP_BUDGET; i++)
+  {
+    Packet p;
+    bool eof = false;
+    if(!is_close)
+    {
+      //环形缓冲区剩下的空间放得下一帧才解码,这样write_audio_frame不会阻塞工作线程
+      if(pcm_ring->capacity() - pcm_ring->size() < pcm_ring->capacity() / 4)
       {
-        pts = 0;
+        return TaskStatus::IDLE;
       }
-      pts *= av_q2d(vStream->time_base);
-      pts = synchronize_video(frame, pts);//处理一下pts
-      vFrame_queue.push({frame, pts});
-      video_Frame_cond.notify_all();
+      if(!aPacket_queue.try_pop(p))
+      {
+        return TaskStatus::IDLE;
+      }
+      eof = !p.pkt;
     }
-    else if(codecCtx->codec->type == AVMEDIA_TYPE_AUDIO)
+    if(is_close)
+    {
+      audio_decode_done = true;
+      pcm_ring->close();
+      std::cout << "音频解码结束" << std::endl;
+      return TaskStatus::DONE;
+    }
+    if(eof)
+    {
+      audio_eof(p.serial);
+      continue;
+    }
+    audio_packet(p);
+  }
+  return TaskStatus::RUNNING;
+}
+
+//无头且不限速时代替showFrame
+TaskStatus MediaPlayer::video_sink_step()  {
+  for(int i = 0; i < EXECUTOR_STEP_BUDGET; i++)
+  {
+    //和showFrame一样,画面和声音都放完了就结束,让等在末尾的读包和解码任务退出
+    if(!is_close && video_end_serial == serial && !seek_req && audio_finished())
+    {
+      quit();
+    }
+    Frame vf;
+    bool got = !is_close && vFrame_queue.try_pop(vf);
+    if(is_close)
+    {
+      std::cout << "视频播放结束" << std::endl;
+      return TaskStatus::DONE;
+    }
+    if(!got)
+    {
+      return TaskStatus::IDLE;
+    }
+    if(!vf.frame)
     {
-      std::lock_guard<std::mutex> lock(audio_Frame_mtx);
-      if(aFrame_queue.size() > MAX_QUEUE_SIZE)
+      if(vf.serial == serial)
       {
-        AVFrame *old = aFrame_queue.front().frame;
-        aFrame_queue.pop();
-        av_frame_free(&old);
+        video_end_serial = vf.serial;
       }
-      if(packet->pts != AV_NOPTS_VALUE)
+      continue;
+    }
+    if(accept_frame(vf) && !present_unpaced(vf))
+    {
+      //转换失败,结束播放
+      vFrame_pool.release(vf.frame);
+      quit();
+    }
+  }
+  return TaskStatus::RUNNING;
+}
+
+//无头且不限速时代替null_audio_sink
+TaskStatus MediaPlayer::audio_sink_step()  {
+  for(int i = 0; i < EXECUTOR_STEP_BUDGET; i++)
+  {
+    if(is_close || pcm_ring->empty())
+    {
+      if(is_close || audio_finished())
       {
-        pts = packet->pts * av_q2d(aStream->time_base);
+        std::cout << "音频输出结束" << std::endl;
+        return TaskStatus::DONE;
       }
-      //获取音频帧大小
-      int data_size = av_samples_get_buffer_size(frame->linesize, frame->ch_layout.nb_channels, frame->nb_samples, aCodecCtx->sample_fmt, 1);
-      aFrame_queue.push({frame,pts, data_size});
-      audio_Frame_cond.notify_all();
+      return TaskStatus::IDLE;
     }
+    audioCallback(this, sink_buf.data(), sink_buf.size());
   }
-  return 0;
+  return TaskStatus::RUNNING;
 }
- 
-void MediaPlayer::video_thread()  {
 
-  std::unique_lock<std::mutex> lock(video_Packet_mtx);
-  while(true)
-  {
-    //条件变量阻塞直到有新数据进来
-    video_Packet_cond.wait_for(lock, std::chrono::milliseconds(1000), [&](){
-      return !vPacket_queue.empty();
-    });
-    //等待1000ms还没有数据认为程序已经结束
-    if(is_close && vPacket_queue.empty())break;
-    else if(vPacket_queue.empty())continue;//如果状态没有设置为已经关闭则继续
-    AVPacket *pkt = vPacket_queue.front();
-    vPacket_queue.pop();
-    //解码并放到帧队列
-    decode_packet(pCodecCtx, pkt);
-    av_packet_free(&pkt);
+void MediaPlayer::submit_task(TaskStatus (MediaPlayer::*step)(), double *cpu)  {
+  {
+    std::lock_guard<std::mutex> lock(tasks_mutex);
+    pipeline_tasks++;
   }
-  std::cout << "视频解码结束" << std::endl;
+  options_.executor->submit(
+    [this, step, cpu]() {
+      //工作线程是共享的,只能按每一步累加cpu时间
+      double begin = thread_cpu_seconds();
+      TaskStatus status = (this->*step)();
+      *cpu += thread_cpu_seconds() - begin;
+      return status;
+    },
+    [this]() { task_finished(pipeline_tasks); });
 }
 
+void MediaPlayer::task_finished(int &count)  {
+  std::lock_guard<std::mutex> lock(tasks_mutex);
+  count--;
+  tasks_cv.notify_all();
+}
  
-void MediaPlayer::audio_thread()  {
+//无头模式下代替声卡的音频输出,有数据就立刻拉取,不按采样率限速
+//paced时模拟真实声卡,按采样率的节奏周期性地调用回调
+void MediaPlayer::null_audio_sink(bool paced)  {
+  std::vector<Uint8> buf(spec.size);
+  double period = (double)spec.samples / (spec.freq * (1.0 + options_.audio_clock_skew));
+  double next = monotonic_now();
+  while(!is_close)
+  {
+    if(paced)
+    {
+      if(audio_finished())break;
+      next += period;
+      if(std::isnan(sleep_until_or_quit(next)))break;
+    }
+    //解码端写完一个serial的数据时会叫醒这里,但可能恰好在判断之后、开始等待之前,所以等待时间取得短一些
+    else if(!pcm_ring->wait(EVENT_POLL_INTERVAL))
+    {
+      if(audio_finished())break;
+      continue;
+    }
+    audioCallback(this, buf.data(), buf.size());
+  }
+  audio_sink_cpu = thread_cpu_seconds();
+  std::cout << "音频输出结束" << std::endl;
+}
 
-  std::unique_lock<std::mutex> lock(audio_Packet_mtx);
-  while(true)
-  {
-    //条件变量阻塞直到有新数据进来(最多等待1000ms)
-    audio_Packet_cond.wait_for(lock, std::chrono::milliseconds(1000), [&](){
-        return !aPacket_queue.empty();
-    });
-    //等待1000ms还没有数据且设置关闭状态则认为程序已经结束
-    if(is_close && aPacket_queue.empty())break;
-    else if(aPacket_queue.empty())continue;
-    AVPacket *pkt = aPacket_queue.front();
-    aPacket_queue.pop();
-    decode_packet(aCodecCtx, pkt);
-    av_packet_free(&pkt);
+void MediaPlayer::open_audio_device()  {
+  if(SDL_InitSubSystem(SDL_INIT_AUDIO) == 0)
+  {
+    sdl_audio_inited = true;
+    //每个播放器打开自己的设备,不用全局的SDL_OpenAudio,同一进程里的多个播放器可以同时出声
+    audio_dev = SDL_OpenAudioDevice(NULL, 0, &wanted_spec, &spec, 0);
   }
-  std::cout << "音频解码结束" << std::endl;
+  if(audio_dev == 0)
+  {
+    std::cerr << "sdl打开音频失败:" << SDL_GetError() << ",不播放声音" << std::endl;
+    spec = wanted_spec;
+    spec.size = spec.samples * spec.channels * 2;
+    null_audio_sink(true);
+    return;
+  }
+  //开始播放音频,回调从这之后才会被调用
+  SDL_PauseAudioDevice(audio_dev, 0);
 }
- 
+
+//统计线程:定期采样各队列深度,响应SIGUSR1/按键的输出请求,并按stats_interval周期输出JSON
+void MediaPlayer::stats_thread()  {
+  while(!pipeline_done)
+  {
+    std::this_thread::sleep_for(STATS_SAMPLE_INTERVAL);
+    stats_sample();
+  }
+}
+
+//采样一次队列深度,有输出请求或者到了输出周期就输出统计
+//执行器模式下作为一个一直IDLE的任务运行,退避到上限后大约也是STATS_SAMPLE_INTERVAL采样一次
+void MediaPlayer::stats_sample()  {
+  metrics.depth(QueueId::VIDEO_PACKETS).record(vPacket_queue.size());
+  metrics.depth(QueueId::AUDIO_PACKETS).record(aPacket_queue.size());
+  metrics.depth(QueueId::VIDEO_FRAMES).record(vFrame_queue.size());
+  metrics.depth(QueueId::AUDIO_PCM).record(pcm_ring->size());
+
+  bool dump = dump_stats_req.exchange(false);
+  uint64_t generation = stats_dump_generation();
+  if(generation != stats_seen_generation)
+  {
+    stats_seen_generation = generation;
+    dump = true;
+  }
+  if(options_.stats_interval > 0 && std::chrono::steady_clock::now() >= next_stats_dump)
+  {
+    next_stats_dump += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(options_.stats_interval));
+    dump = true;
+  }
+  if(dump)
+  {
+    dump_stats();
+  }
+}
+
+//所有计数器和直方图组成的JSON
+std::string MediaPlayer::stats_json() const  {
+  PipelineStats st = stats();
+  char buf[2048];
+  snprintf(buf, sizeof(buf),
+           ",\"decoded_frames\":%llu,\"drained_frames\":%llu,\"rendered_frames\":%llu,\"audio_samples\":%llu,"
+           "\"audio_compensated_frames\":%llu,\"audio_fast_frames\":%llu,\"indexed_seeks\":%llu,"
+           "\"demux_bytes\":%llu,\"shell_allocations\":%llu,\"frames_dropped\":%llu,\"frames_late\":%llu,"
+           "\"open_ms\":%.1f,\"ttff_ms\":%.1f,\"ttfa_ms\":%.1f,\"stream_cache_hit\":%s,"
+           "\"live_underruns\":%llu,\"live_jumps\":%llu,"
+           "\"record\":{\"packets\":%llu,\"bytes\":%llu,\"dropped\":%llu,\"skipped\":%llu},"
+           "\"gop_cache\":{\"hits\":%llu,\"misses\":%llu,\"gops_decoded\":%llu,\"prefetched\":%llu,"
+           "\"evictions\":%llu,\"bytes\":%llu,\"peak_bytes\":%llu},\"metrics\":",
+           (unsigned long long)st.decoded_frames, (unsigned long long)st.drained_frames,
+           (unsigned long long)st.rendered_frames, (unsigned long long)st.audio_samples,
+           (unsigned long long)st.audio_compensated_frames, (unsigned long long)st.audio_fast_frames,
+           (unsigned long long)st.indexed_seeks, (unsigned long long)st.demux_bytes,
+           (unsigned long long)st.shell_allocations, (unsigned long long)st.frames_dropped,
+           (unsigned long long)st.frames_late, st.open_seconds * 1000, st.time_to_first_frame * 1000,
+           st.time_to_first_audio * 1000, st.stream_cache_hit ? "true" : "false",
+           (unsigned long long)st.live_underruns, (unsigned long long)st.live_jumps,
+           (unsigned long long)st.record.packets_written, (unsigned long long)st.record.bytes_written,
+           (unsigned long long)st.record.packets_dropped, (unsigned long long)st.record.packets_skipped,
+           (unsigned long long)st.gop_cache.hits, (unsigned long long)st.gop_cache.misses,
+           (unsigned long long)st.gop_cache.gops_decoded, (unsigned long long)st.gop_cache.gops_prefetched,
+           (unsigned long long)st.gop_cache.evictions, (unsigned long long)st.gop_cache.bytes,
+           (unsigned long long)st.gop_cache.peak_bytes);
+  //url长度不定,也可能带引号,单独转义后拼接,不放进固定大小的缓冲区
+  return "{\"url\":\"" + json_escape(url_) + "\"" + buf + metrics.to_json() + "}";
+}
+
+//输出一行JSON,没有指定文件时输出到标准错误
+void MediaPlayer::dump_stats()  {
+  std::string json = stats_json();
+  if(options_.stats_path.empty())
+  {
+    fprintf(stderr, "%s\n", json.c_str());
+    return;
+  }
+  FILE *f = fopen(options_.stats_path.c_str(), "a");
+  if(!f)
+  {
+    std::cerr << "打开统计文件失败:" << options_.stats_path << std::endl;
+    return;
+  }
+  fprintf(f, "%s\n", json.c_str());
+  fclose(f);
+}
+
+void MediaPlayer::seek(double pos, double rel)  {
+  //直播流不能seek
+  if(options_.live)
+  {
+    return;
+  }
+  seek_pos = (int64_t)(pos * AV_TIME_BASE);
+  seek_rel = (int64_t)(rel * AV_TIME_BASE);
+  seek_request_time = monotonic_now();
+  seek_req = true;
+  //读包线程可能已经读到末尾,正在等seek
+  demux_event.notify();
+}
+
+void MediaPlayer::step(int frames)  {
+  step_req += frames;
+}
+
+void MediaPlayer::play_reverse(bool on)  {
+  reverse_req = on;
+}
+
+void MediaPlayer::resume()  {
+  resume_req = true;
+}
+
+bool MediaPlayer::probe_stream_info()  {
+  std::string cache = options_.stream_cache && !options_.live ? sidecar_path(url_, options_.cache_dir, ".stinfo") : "";
+  if(!cache.empty())
+  {
+    int64_t probesize = pFormatCtx->probesize;
+    int64_t analyzeduration = pFormatCtx->max_analyze_duration;
+    pFormatCtx->probesize = CACHED_PROBESIZE;
+    pFormatCtx->max_analyze_duration = CACHED_ANALYZEDURATION;
+    int ret = avformat_find_stream_info(pFormatCtx, NULL);
+    pFormatCtx->probesize = probesize;
+    pFormatCtx->max_analyze_duration = analyzeduration;
+    if(ret >= 0 && apply_stream_info(cache, url_, pFormatCtx))
+    {
+      stream_cache_hit = true;
+      return true;
+    }
+  }
+  //没有缓存或者缓存失效,完整探测一遍再写缓存
+  if(avformat_find_stream_info(pFormatCtx, NULL) < 0)
+  {
+    return false;
+  }
+  if(!cache.empty())
+  {
+    save_stream_info(cache, url_, pFormatCtx);
+  }
+  return true;
+}
+
+void MediaPlayer::init_keyframe_index()  {
+  std::string media = url_;
+  std::string path = KeyframeIndex::path_for(media, options_.cache_dir);
+  if(path.empty())
+  {
+    //不是本地文件
+    return;
+  }
+  keyframe_index.reset(new KeyframeIndex());
+  if(keyframe_index->load(path, media))
+  {
+    std::cout << "加载关键帧索引: " << keyframe_index->size() << "个关键帧" << std::endl;
+    index_ready = true;
+    return;
+  }
+  //单独打开一份文件扫描,不影响播放的读取位置
+  index_thread = std::thread([this, media, path]() {
+    if(KeyframeIndex::build(media, path, index_cancel) && keyframe_index->load(path, media))
+    {
+      std::cout << "建立关键帧索引: " << keyframe_index->size() << "个关键帧" << std::endl;
+      index_ready = true;
+    }
+  });
+}
+
+double MediaPlayer::duration() const  {
+  if(!pFormatCtx || pFormatCtx->duration == AV_NOPTS_VALUE)
+  {
+    return 0;
+  }
+  return (double)pFormatCtx->duration / AV_TIME_BASE;
+}
+
+//seek到目标位置之前最近的关键帧,然后serial加一,让各线程丢掉旧数据
+//队列都是单生产者单消费者的,这里不能去清空它们,由消费者按serial丢弃
+void MediaPlayer::do_seek()  {
+  int64_t target = seek_pos;
+  int64_t rel = seek_rel;
+  seek_req = false;
+  //向后跳时不能落到当前位置之前,向前跳时不能落到当前位置之后
+  int64_t seek_min = rel > 0 ? target - rel + 2 : INT64_MIN;
+  int64_t seek_max = rel < 0 ? target - rel - 2 : INT64_MAX;
+  int ret = -1;
+  if(index_ready)
+  {
+    //有索引时二分找到目标之前最近的关键帧,直接按字节位置跳过去,不依赖文件自带的seek信息
+    const KeyframeEntry *e = keyframe_index->find(target);
+    if(e && e->pts < seek_min && e + 1 != keyframe_index->end())
+    {
+      e++;
+    }
+    if(e && e->pts <= seek_max)
+    {
+      ret = av_seek_frame(pFormatCtx, -1, e->pos, AVSEEK_FLAG_BYTE);
+      if(ret >= 0)
+      {
+        indexed_seeks++;
+      }
+    }
+  }
+  if(ret < 0)
+  {
+    ret = avformat_seek_file(pFormatCtx, -1, seek_min, target, seek_max, 0);
+  }
+  if(ret < 0)
+  {
+    std::cerr << "seek失败:" << av_err2str(ret) << std::endl;
+    return;
+  }
+  //先写目标时间再改serial,解码线程看到新serial的包时一定能看到新的目标时间
+  bool accurate = seek_accurate_req.exchange(false) || options_.accurate_seek;
+  seek_target = accurate ? (double)target / AV_TIME_BASE : NAN;
+  serial++;
+  //新的位置读到末尾时要重新放结束标记
+  video_eof_sent = false;
+  audio_eof_sent = false;
+  //解码线程可能正阻塞在满的帧队列/环形缓冲区上,叫醒它们尽快发现serial变了
+  vFrame_queue.wake_all();
+  pcm_ring->wake_all();
+}
+
 void MediaPlayer::start()  {
-  th[0] = std::thread(&MediaPlayer::readData, this); 
-  th[1] = std::thread(&MediaPlayer::video_thread, this); 
-  th[2] = std::thread(&MediaPlayer::audio_thread, this); 
-  th[3] = std::thread(&MediaPlayer::showFrame, this);
-
-  th[0].join();
-  th[1].join();
-  th[2].join();
-  th[3].join();
+  start_async();
+  wait();
+}
+
+void MediaPlayer::start_async()  {
+  pipeline_done = false;
+  stats_seen_generation = stats_dump_generation();
+  next_stats_dump = std::chrono::steady_clock::now() +
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(options_.stats_interval));
+  if(!options_.executor)
+  {
+    monitor = std::thread(&MediaPlayer::stats_thread, this);
+    th.emplace_back(&MediaPlayer::readData, this);
+    th.emplace_back(&MediaPlayer::video_thread, this);
+    th.emplace_back(&MediaPlayer::audio_thread, this);
+    th.emplace_back(&MediaPlayer::showFrame, this);
+    //窗口在showFrame线程里创建,声卡在单独的线程里打开,都和读包解码同时进行
+    if(options_.headless)
+    {
+      th.emplace_back(&MediaPlayer::null_audio_sink, this, options_.headless_paced);
+    }
+    else
+    {
+      th.emplace_back(&MediaPlayer::open_audio_device, this);
+    }
+    return;
+  }
+  //读包和解码作为任务跑在共享的执行器上
+  submit_task(&MediaPlayer::demux_step, &demux_cpu);
+  submit_task(&MediaPlayer::video_decode_step, &video_decode_cpu);
+  submit_task(&MediaPlayer::audio_decode_step, &audio_decode_cpu);
+  if(options_.headless && !options_.headless_paced)
+  {
+    sink_buf.resize(spec.size);
+    submit_task(&MediaPlayer::video_sink_step, &video_sink_cpu);
+    submit_task(&MediaPlayer::audio_sink_step, &audio_sink_cpu);
+  }
+  else
+  {
+    //要按时钟节奏睡眠等待的显示和音频输出仍然使用专用线程
+    th.emplace_back(&MediaPlayer::showFrame, this);
+    if(options_.headless)
+    {
+      th.emplace_back(&MediaPlayer::null_audio_sink, this, true);
+    }
+    else
+    {
+      th.emplace_back(&MediaPlayer::open_audio_device, this);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(tasks_mutex);
+    stats_tasks++;
+  }
+  options_.executor->submit(
+    [this]() {
+      if(pipeline_done)
+      {
+        return TaskStatus::DONE;
+      }
+      stats_sample();
+      return TaskStatus::IDLE;
+    },
+    [this]() { task_finished(stats_tasks); });
+}
+
+void MediaPlayer::wait()  {
+  if(options_.executor)
+  {
+    std::unique_lock<std::mutex> lock(tasks_mutex);
+    tasks_cv.wait(lock, [this]() { return pipeline_tasks == 0; });
+  }
+  for(auto &t : th)
+  {
+    t.join();
+  }
+  th.clear();
+  //读包已经结束,等录制线程写完剩下的包和文件尾
+  if(recorder)
+  {
+    recorder->finish();
+  }
+  pipeline_done = true;
+  if(options_.executor)
+  {
+    std::unique_lock<std::mutex> lock(tasks_mutex);
+    tasks_cv.wait(lock, [this]() { return stats_tasks == 0; });
+  }
+  else
+  {
+    monitor.join();
+  }
+  print_summary();
+}
+
+void MediaPlayer::print_summary()  {
+  std::cout << "解码帧数:" << decoded_frames << "(结束时冲出" << drained_frames << "帧) AVFrame/AVPacket分配次数:"
+            << shell_allocations() << std::endl;
+  //打印各队列的最高水位和进程的峰值内存
+  PipelineStats st = stats();
+  auto print_queue = [](const char *name, const QueueStats &q) {
+    std::cout << name << " 最高水位: " << q.size_high_water << "个 "
+              << q.bytes_high_water / 1024 << "KB " << q.duration_high_water << "s" << std::endl;
+  };
+  std::cout << "打开耗时:" << st.open_seconds * 1000 << "ms 首帧画面:" << st.time_to_first_frame * 1000
+            << "ms 首帧声音:" << st.time_to_first_audio * 1000 << "ms" << std::endl;
+  print_queue("视频包队列", st.video_packets);
+  print_queue("音频包队列", st.audio_packets);
+  print_queue("视频帧队列", st.video_frames);
+  std::cout << "音频环形缓冲区 最高水位: " << st.audio_ring_high_water / 1024 << "KB/"
+            << st.audio_ring_capacity / 1024 << "KB" << std::endl;
+  //音频回调跑在实时线程上,最坏耗时比平均值更重要
+  const Histogram &cb = metrics.stage(Stage::AUDIO_CALLBACK);
+  std::cout << "音频回调耗时 p99:" << cb.percentile(0.99) / 1000.0 << "us 最大:" << cb.max() / 1000.0 << "us" << std::endl;
+  //本地文件上seek到第一帧显示的目标是100ms以内
+  const Histogram &sk = metrics.seek_latency;
+  if(sk.count() > 0)
+  {
+    std::cout << "seek " << sk.count() << "次(使用索引" << indexed_seeks << "次) 耗时 p50:" << sk.percentile(0.5) / 1e6
+              << "ms 最大:" << sk.max() / 1e6 << "ms" << std::endl;
+  }
+  if(gop_cache_ready)
+  {
+    const GopCacheStats &g = st.gop_cache;
+    uint64_t lookups = g.hits + g.misses;
+    std::cout << "GOP缓存 命中率:" << (lookups ? 100.0 * g.hits / lookups : 0) << "%(" << g.hits << "/" << lookups
+              << ") 解码" << g.gops_decoded << "个GOP(后台" << g.gops_prefetched << "个) 耗时" << g.decode_seconds
+              << "s 淘汰" << g.evictions << "个 内存:" << g.bytes / (1024 * 1024) << "MB 最高:"
+              << g.peak_bytes / (1024 * 1024) << "MB" << std::endl;
+  }
+  if(options_.live)
+  {
+    const Histogram &lat = metrics.live_latency;
+    std::cout << "直播缓冲延迟 p50:" << lat.percentile(0.5) / 1e6 << "ms p99:" << lat.percentile(0.99) / 1e6
+              << "ms 重新缓冲:" << live_underruns << "次 跳到目标延迟:" << live_jumps << "次" << std::endl;
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  std::cout << "峰值内存: " << usage.ru_maxrss / 1024 << "MB" << std::endl;
   std::cout << "执行完毕" << std::endl;
 }
+
+PipelineStats MediaPlayer::stats() const  {
+  PipelineStats st;
+  st.video_packets = vPacket_queue.stats();
+  st.audio_packets = aPacket_queue.stats();
+  st.video_frames = vFrame_queue.stats();
+  st.audio_ring_capacity = pcm_ring ? pcm_ring->capacity() : 0;
+  st.audio_ring_high_water = pcm_high_water;
+  st.decoded_frames = decoded_frames;
+  st.drained_frames = drained_frames;
+  st.shell_allocations = shell_allocations();
+  st.demux_bytes = demux_bytes;
+  st.rendered_frames = rendered_frames;
+  st.audio_samples = audio_samples;
+  st.frames_dropped = frames_dropped;
+  st.frames_late = frames_late;
+  st.audio_compensated_frames = audio_compensated_frames;
+  st.audio_fast_frames = audio_fast_frames;
+  st.indexed_seeks = indexed_seeks;
+  st.open_seconds = opened ? open_end - open_begin : -1;
+  st.time_to_first_frame = std::isnan(first_frame_time) ? -1 : first_frame_time - open_begin;
+  st.time_to_first_audio = std::isnan(first_audio_time) ? -1 : first_audio_time - open_begin;
+  st.stream_cache_hit = stream_cache_hit;
+  st.live_underruns = live_underruns;
+  if(gop_cache_ready)
+  {
+    st.gop_cache = gop_cache->stats();
+  }
+  if(recorder)
+  {
+    st.record = recorder->stats();
+  }
+  st.live_jumps = live_jumps;
+  st.resume_pts = resume_pts;
+  st.resume_first_pts = resume_first_pts;
+  st.demux_cpu = demux_cpu;
+  st.video_decode_cpu = video_decode_cpu;
+  st.audio_decode_cpu = audio_decode_cpu;
+  st.video_sink_cpu = video_sink_cpu;
+  st.audio_sink_cpu = audio_sink_cpu;
+  return st;
+}
+
+uint64_t MediaPlayer::shell_allocations() const  {
+  return vPacket_pool.allocations() + aPacket_pool.allocations() +
+         vFrame_pool.allocations() + aFrame_pool.allocations();
+}
  
 //如果帧存在pts,直接返回即可，如果缺失，则通过video_clock来得到
 double MediaPlayer::synchronize_video(AVFrame *frame, double pts)  {
@@ -663,32 +2400,16 @@ double MediaPlayer::synchronize_video(AVFrame *frame, double pts)  {
 }
  
 //获得音频时间钟
-//audio_clock记录的是一整个音频帧播放完的时间，但是声卡驱动填充播放还需要时间，所以需要通过计算得到实际正在播放的音频时钟
+//由音频回调在每次填充数据时设置,已经扣除了声卡缓冲里还没播放的数据
 double MediaPlayer::get_audio_clock()  {
-
-  double pts;
-  int hw_buf_size, bytes_per_sec, n;//还没有填充到sdl音频播放驱动里的数据量，每秒播放的字节数
-  
-  pts = audio_clock;
-  hw_buf_size = audio_buf_size - audio_buf_index;
-  bytes_per_sec = 0;
-  n = aCodecCtx->ch_layout.nb_channels * AV_SAMPLE_FMT_S16;//声道数✖️每个声道使用的位深(这里固定为了AV_SAMPLE_FMT_S16)
-  bytes_per_sec = aCodecCtx->sample_rate * n;
-  double tmp = (double)hw_buf_size / bytes_per_sec;
-  if(pts >= tmp)
-  {
-    pts -= tmp;
-  }
-  return pts;//实际播放的时间
+  //seek之后还没被新数据更新过的时钟是无效的
+  return audclk.serial() == serial ? audclk.get() : NAN;
 }
  
 //获取视频时钟
-//这样实现而不是简单的使用pts可以防止误差过大
+//每显示一帧设置一次,中间按单调时钟的流逝外推
 double MediaPlayer::get_video_clock()  {
-  double delta;
-  gettimeofday(&cur_time, NULL);
-  delta = (cur_time.tv_sec - video_current_pts_time.tv_sec) + (cur_time.tv_usec - video_current_pts_time.tv_usec) / 1000000.0;
-	return video_current_pts + delta;
+  return vidclk.serial() == serial ? vidclk.get() : NAN;
 }
  
 double MediaPlayer::get_master_clock()  {
@@ -707,32 +2428,33 @@ double MediaPlayer::get_master_clock()  {
 }
  
 //同步音频时钟 
-//通过调整采样大小
+//通过调整采样数
 /*
  * 通过写音频同步视频这个函数可以了解的难点：
  * 我们如果单纯使用diff进行调整， 如果某次diff跳动过大，就会引起音频采样大幅度变化
  * 而这样就会严重影响用户观看
  * 采用的方式就是指数加权平均移动
  * 让diff平滑调整，选择一个稳定的diff进行调整，这样就不会使大幅度的diff变化影响整体
+ * 返回这一帧希望输出的采样数,真正的伸缩交给重采样器(swr_set_compensation)平滑地完成,
+ * 不再复制最后一个采样点或者直接截断
 */
-int MediaPlayer::synchronize_audio(short *samples, int samples_size, double pts)  {
+int MediaPlayer::synchronize_audio(int nb_samples)  {
 
-  int n;
-  double ref_clock;
-  n = 2 * aCodecCtx->ch_layout.nb_channels;
+  int wanted_nb_samples = nb_samples;
+  double ref_clock = NAN;
+  double diff = NAN, avg_diff = NAN;//误差和平滑后的误差
 
   if(av_sync_type != AV_SYNC_TYPE::AV_SYNC_AUDIO_MASTER)
   {
-    double diff, avg_diff;//误差和平滑后的误差
-    int wanted_size, min_size, max_size; //nb_samples
+    int min_nb_samples, max_nb_samples;
 
     //这里是视频时钟为主.所以返回的是视频时钟
     ref_clock = get_master_clock();
     //当前音频时钟和视频时钟的差值
     diff = get_audio_clock() - ref_clock;
 
-    //较小时才去矫正
-    if(diff < AV_NOSYNC_THRESHOLD)
+    //较小时才去矫正(两个时钟都有效才有意义)
+    if(!std::isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD)
     {
       //使用指数加权平均对差值进行平滑防止跳变引起错误的调整
       //差值平滑累计
@@ -748,51 +2470,12 @@ int MediaPlayer::synchronize_audio(short *samples, int samples_size, double pts)
         avg_diff = audio_diff_cum * (1.0 - audio_diff_avg_coef);   
         if(fabs(avg_diff) >= audio_diff_threshold)
         {
-          //采样大小 = 采样率（1s采样多少次）* 差距时间 * 每个采样点的字节数 * 通道数
-          //也就是让采样大小更大或者更小，更大点就能让视频更长，否则更短
-          wanted_size = samples_size + (int)(diff * aCodecCtx->sample_rate) * n;
-          min_size = samples_size * (100 - SAMPLE_CORRECTION_PERCENT_MAX) / 100;
-          max_size = samples_size * (100 + SAMPLE_CORRECTION_PERCENT_MAX) / 100;
-          
-          if(wanted_size < min_size)
-          {
-            wanted_size = min_size;
-          }
-          else if(wanted_size > max_size)
-          {
-            wanted_size = wanted_size;
-          }
-          if(wanted_size < samples_size)
-          {
-            //如果是缩减直接删掉后面的
-            samples_size = wanted_size;
-          }
-          else if(wanted_size > samples_size)
-          {
-            uint8_t *sample_end, *q;
-            int nb;
-
-            //通过复制后面的采样点来加长音频
-            nb = wanted_size - samples_size;//需要增加的字节数
-            sample_end = (uint8_t*)samples + samples_size - n;
-
-            //分配新buffer(防止内存区域大小不够)
-            uint8_t *new_samples = (uint8_t*)av_malloc(wanted_size);
-            memcpy(new_samples, samples, samples_size);
-
-            //填充新样本
-            q = new_samples + samples_size;
-            while(nb > 0)
-            {
-              memcpy(q, sample_end, n);
-              q += n;
-              nb -= n;
-            }
-            //释放原来的buffer并指向新buffer
-            av_free(samples);
-            samples = (short*)new_samples;
-            samples_size = wanted_size;
-          }
+          //采样数 = 原采样数 + 采样率（1s采样多少次）* 差距时间
+          //也就是让采样数更多或者更少，更多点就能让音频播放得更久，等一等视频，否则更短
+          wanted_nb_samples = nb_samples + (int)(diff * aCodecCtx->sample_rate);
+          min_nb_samples = nb_samples * (100 - SAMPLE_CORRECTION_PERCENT_MAX) / 100;
+          max_nb_samples = nb_samples * (100 + SAMPLE_CORRECTION_PERCENT_MAX) / 100;
+          wanted_nb_samples = av_clip(wanted_nb_samples, min_nb_samples, max_nb_samples);
         }
       }
     }
@@ -803,10 +2486,94 @@ int MediaPlayer::synchronize_audio(short *samples, int samples_size, double pts)
       audio_diff_cum = 0;
     }
   }
-  return samples_size;
+  if(options_.sync_trace)
+  {
+    SyncTrace *trace = options_.sync_trace;
+    double audio = get_audio_clock();
+    trace->add_audio({trace->elapsed(), audio, std::isnan(ref_clock) ? get_master_clock() : ref_clock, diff, avg_diff,
+                      nb_samples, wanted_nb_samples});
+  }
+  return wanted_nb_samples;
 }
  
+//外部时钟,跟随音频/视频时钟走,不再直接返回系统的绝对时间
+//直播模式下跟随数据到达的速度,见live_update
 double MediaPlayer::get_external_clock()  {
-  gettimeofday(&cur_time, NULL);
-	return cur_time.tv_sec + cur_time.tv_usec / 1000000.0;
+  if(extclk.serial() != serial)
+  {
+    return NAN;
+  }
+  double clock = extclk.get();
+  //不能播到还没收到的数据后面去,断流时画面停在最后一帧等待
+  double arrival = live_arrival;
+  if(options_.live && clock > arrival)
+  {
+    return arrival;
+  }
+  return clock;
+}
+
+/*
+ * 直播的jitter buffer
+ * 缓冲延迟 = 收到的最新数据的pts - 外部时钟,目标是保持在options_.live_latency附近
+ * 多了就让外部时钟稍微走快一点(音频靠重采样补偿跟上,视频按主时钟丢帧),少了就稍微走慢一点
+ * 多得太多就直接跳到目标延迟;外部时钟走到了最新数据后面说明断流了,等数据来了从目标延迟重新开始
+ * 只有readData线程写extclk
+ */
+void MediaPlayer::live_update()  {
+  AVStream *st = NULL;
+  if(packet->stream_index == videoStreamIndex)
+  {
+    st = vStream;
+  }
+  else if(packet->stream_index == audioStreamIndex)
+  {
+    st = aStream;
+  }
+  int64_t ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+  if(!st || ts == AV_NOPTS_VALUE)
+  {
+    return;
+  }
+  double pts = ts * av_q2d(st->time_base);
+  double arrival = live_arrival;
+  //音视频交错到达,只有更新的数据才推进到达位置;往回跳很多说明时间戳重置了
+  if(!std::isnan(arrival) && pts <= arrival && arrival - pts < AV_NOSYNC_THRESHOLD)
+  {
+    return;
+  }
+  live_arrival = pts;
+  double target = options_.live_latency;
+  double clock = extclk.serial() == serial ? extclk.get() : NAN;
+  if(std::isnan(clock) || std::fabs(pts - clock) > AV_NOSYNC_THRESHOLD || clock > pts)
+  {
+    //第一个包,时间戳不连续,或者断流期间时钟已经走过了新到的数据:从目标延迟重新开始缓冲
+    if(!std::isnan(clock) && clock > pts)
+    {
+      live_underruns++;
+    }
+    extclk.set(pts - target, serial);
+    extclk.set_speed(1.0);
+    return;
+  }
+  double latency = pts - clock;
+  metrics.live_latency.record((int64_t)(latency * 1e9));
+  if(latency > options_.live_max_latency)
+  {
+    live_jumps++;
+    extclk.set(pts - target, serial);
+    extclk.set_speed(1.0);
+    return;
+  }
+  //偏差在容忍范围内按正常速度,超出时按偏差成比例地调整速度
+  double error = latency - target;
+  double speed = 1.0;
+  if(std::fabs(error) > target * LIVE_LATENCY_TOLERANCE)
+  {
+    speed = 1.0 + std::max(-LIVE_MAX_SPEED_ADJUST, std::min(error * LIVE_SPEED_GAIN, LIVE_MAX_SPEED_ADJUST));
+  }
+  if(std::fabs(speed - extclk.speed()) > 0.001)
+  {
+    extclk.set_speed(speed);
+  }
 }
@@ -7,30 +7,79 @@ extern "C" {
 #include <libswscale/swscale.h>
 #include <libswresample/swresample.h>
 #include <libavutil/channel_layout.h>
+#include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
 }
 #include <iostream>
-#include <queue>
+#include <string>
+#include <chrono>
 #include <thread>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <condition_variable>
-#include <sys/time.h>
-#include <atomic>
+#include "spsc_queue.h"
+#include "object_pool.h"
+#include "media_queue.h"
+#include "pcm_ring.h"
+#include "stats.h"
+#include "clock.h"
+#include "keyframe_index.h"
+#include "stream_cache.h"
+#include "sidecar.h"
+#include "mmap_io.h"
+#include "executor.h"
+#include "audio_convert.h"
+#include "thumbnail.h"
+#include "sync_trace.h"
+#include "recorder.h"
+#include "media_frame.h"
+#include "gop_cache.h"
 namespace
 {
+  //队列的槽位数上限,实际的背压由PlayerOptions里按字节和时长的上限决定
   const int MAX_QUEUE_SIZE = 1024;
+  //对象池除了队列里的对象,还要容纳各线程手上正在处理的对象
+  const int POOL_SLACK = 16;
+  //自动选择时格式转换最多使用的线程数,再多收益就很小了
+  const int MAX_CONVERT_THREADS = 8;
+  //统计线程采样队列深度的间隔
+  const std::chrono::milliseconds STATS_SAMPLE_INTERVAL(10);
+  //队列满时生产者每隔这么久检查一次是否已经关闭
+  const std::chrono::milliseconds QUEUE_PUSH_TIMEOUT(100);
+  //队列空时消费者最多等待这么久;结束和quit()都会立刻唤醒等待的线程,这只是兜底
+  const std::chrono::milliseconds QUEUE_POP_TIMEOUT(1000);
+  //有窗口时渲染线程最多隔这么久处理一次窗口和键盘事件
+  const std::chrono::milliseconds EVENT_POLL_INTERVAL(10);
   const double AV_SYNC_THRESHOLD = 0.01;//音视频误差超过该阈值需要同步处理
   const double AV_NOSYNC_THRESHOLD = 10.0;//差距超过该值就放弃同步直接播放
   const double MAX_FRAME_DELAY = 100;
+  //frame_timer落后真实时间超过该值就不再追赶,直接从当前时间重新计时
+  const double AV_SYNC_THRESHOLD_MAX = 0.1;
+  //最多连续丢弃的帧数,保证画面在追赶时也能刷新
+  const int MAX_CONSECUTIVE_DROPS = 10;
   const int AUDIO_DIFF_AVG_NB = 10;
   const int SAMPLE_CORRECTION_PERCENT_MAX = 10;
+  //音频补偿结束后连续这么多帧不需要补偿,才从swr切回直接转换
+  const int SWR_FAST_PATH_HOLD = 50;
   const int SDL_AUDIO_BUFFER_SIZE = 1024;
+  //执行器上的任务每一步最多处理这么多个包/帧就让出工作线程,保证各个播放器轮流执行
+  const int EXECUTOR_STEP_BUDGET = 8;
+  //精确seek时显示时段比目标晚结束不到这么久的帧也丢掉,免得浮点误差把目标的前一帧留下
+  const double SEEK_PTS_EPSILON = 0.001;
+  //缩略图模式下seek之后最多送这么多个包给解码器,还解不出关键帧就放弃这一张
+  const int THUMBNAIL_MAX_PACKETS = 32;
+  //有流信息缓存时只做很小的探测,让flv之类的格式把流创建出来就够了
+  const int64_t CACHED_PROBESIZE = 32 * 1024;
+  const int64_t CACHED_ANALYZEDURATION = 100000;
+  //直播模式:缓冲延迟偏离目标不超过这个比例时按正常速度播放
+  const double LIVE_LATENCY_TOLERANCE = 0.2;
+  //直播模式:缓冲延迟每偏离目标1秒,外部时钟的速度调整多少;调整的上限要小于音频重采样能补偿的范围
+  const double LIVE_SPEED_GAIN = 0.05;
+  const double LIVE_MAX_SPEED_ADJUST = 0.05;
 }
-struct Frame
-{
-  AVFrame *frame;
-  double pts;//为什么要特意写pts,因为有可能原视频的pts丢失或者找不到，需要我们自己写
-  int data_bytes = 0;//每帧的字节数，方便音频同步时使用
-};
 enum class AV_SYNC_TYPE
 {
   AV_SYNC_AUDIO_MASTER,
@@ -39,26 +88,184 @@ enum class AV_SYNC_TYPE
 };
 #define DEFAULT_AV_SYNC_TYPE AV_SYNC_TYPE::AV_SYNC_VIDEO_MASTER
 
+//播放器的可配置项
+struct PlayerOptions
+{
+  //各缓冲队列的上限(字节数,秒),任一达到上限时生产者阻塞等待,不再丢弃数据
+  QueueLimits video_packet_limits{15 * 1024 * 1024, 10.0};
+  QueueLimits audio_packet_limits{4 * 1024 * 1024, 10.0};
+  QueueLimits video_frame_limits{64 * 1024 * 1024, 0.5};
+  //音频解码线程重采样后写入的PCM环形缓冲区能放多少秒的数据
+  double audio_ring_duration{0.5};
+  //音量增益(线性倍数),在音频格式转换时一起乘上,超出范围的饱和
+  float audio_gain{1.0f};
+  //输出画面(窗口、纹理、无头模式的转换结果)的目标大小,0表示和视频一样大
+  //只给一个时另一个按显示比例算,都给时在这个框里保持比例;解码器支持lowres时先在解码阶段缩小,再由格式转换一次缩放到输出大小
+  int output_width{0};
+  int output_height{0};
+  //像素格式转换的线程数,0表示按cpu核数自动选择
+  int convert_threads{0};
+  //视频解码线程数,0表示由libavcodec按cpu核数自动选择
+  int decode_threads{0};
+  //FF_THREAD_FRAME/FF_THREAD_SLICE的组合,解码器两种都支持时优先帧线程
+  int decode_thread_type{FF_THREAD_FRAME | FF_THREAD_SLICE};
+  //探测流信息时最多读取的字节数和时长(微秒),0表示使用ffmpeg的默认值,调小可以加快打开但参数可能探测不全
+  int64_t probesize{0};
+  int64_t analyzeduration{0};
+  //把探测到的流参数缓存到sidecar文件,再次打开同一个文件时跳过完整探测
+  bool stream_cache{true};
+  //直播输入(http/rtmp等):以外部时钟为主时钟,外部时钟跟随数据到达的速度,不能seek
+  bool live{false};
+  //直播的目标缓冲延迟(秒):缓冲多了稍微加速追赶,少了稍微减速,数据断了就停下来重新缓冲到这个延迟
+  double live_latency{0.5};
+  //缓冲延迟超过这个值(秒)就不再靠加速慢慢追,直接跳到目标延迟,来不及显示的帧解码时只解参考帧
+  double live_max_latency{3.0};
+  //本地文件通过mmap读取(见MmapIO),不是本地文件时自动使用ffmpeg默认的读取方式
+  bool mmap_io{false};
+  //无头模式:不创建窗口也不打开声卡,视频只做格式转换,音频由null_audio_sink全速拉取,用于基准测试
+  bool headless{false};
+  //无头模式下仍然按时钟节奏显示和播放音频,用来测量同步和显示时间精度
+  bool headless_paced{false};
+  //headless_paced时模拟声卡时钟的偏差,例如0.001表示声卡比标称采样率快0.1%,用来测试音视频漂移的修正
+  double audio_clock_skew{0.0};
+  //按主时钟判断已经来不及显示的帧在转换和上传之前直接丢弃
+  bool drop_late_frames{true};
+  //精确seek:从关键帧开始解码,丢掉目标时间之前的帧;否则直接从关键帧开始播放
+  bool accurate_seek{false};
+  //使用持久化的关键帧索引seek,第一次打开时在后台建立
+  bool keyframe_index{true};
+  //关键帧索引和流信息缓存存放的目录,为空时放在媒体文件旁边
+  std::string cache_dir;
+  //每隔多少秒输出一次统计JSON,0表示只在收到SIGUSR1或按下s键时输出
+  double stats_interval{0};
+  //统计JSON追加写入的文件,为空时输出到标准错误
+  std::string stats_path;
+  //多个播放器共享的执行器,不为空时读包、解码和无头不限速时的输出都作为任务跑在上面,不再各自创建线程
+  //这时decode_threads/convert_threads为0按1处理,并行度来自多路流本身,避免几十路流各按核数开线程
+  //直播流读包时会阻塞在网络上,占住工作线程,不适合放在执行器上
+  Executor *executor{nullptr};
+  //边播边录:不为空时把读到的包原样重新封装写到这个文件,格式按扩展名(flv/mp4/mkv...),不重新编码
+  std::string record_path;
+  //录制缓冲的上限,磁盘跟不上时超过上限的包直接丢掉,不影响播放
+  QueueLimits record_limits{16 * 1024 * 1024, 5.0};
+  //不为空时逐帧记录showFrame和synchronize_audio里的同步参数,由调用者持有,播放结束后读取
+  SyncTrace *sync_trace{nullptr};
+  //逐帧步进和倒放用的解码后GOP缓存的内存上限(字节),第一次步进时才创建,0表示不支持步进和倒放
+  size_t gop_cache_bytes{512 * 1024 * 1024};
+};
+
+//流水线状态,各队列的当前值和最高水位
+struct PipelineStats
+{
+  QueueStats video_packets;
+  QueueStats audio_packets;
+  QueueStats video_frames;
+  //PCM环形缓冲区的容量和最高水位(字节)
+  uint64_t audio_ring_capacity{0};
+  uint64_t audio_ring_high_water{0};
+  uint64_t decoded_frames{0};
+  //读到文件末尾后冲解码器得到的帧数,以前这些帧会丢掉
+  uint64_t drained_frames{0};
+  uint64_t shell_allocations{0};
+  //吞吐量计数
+  uint64_t demux_bytes{0};
+  uint64_t rendered_frames{0};
+  uint64_t audio_samples{0};
+  //因迟到被丢弃的帧,以及错过了显示时段但仍然显示的帧
+  uint64_t frames_dropped{0};
+  uint64_t frames_late{0};
+  //做过重采样补偿的音频帧数
+  uint64_t audio_compensated_frames{0};
+  //不经过swr、由特化的转换函数直接转换的音频帧数
+  uint64_t audio_fast_frames{0};
+  //通过关键帧索引完成的seek次数
+  uint64_t indexed_seeks{0};
+  //启动耗时(秒,从构造开始计时):构造函数本身,第一帧画面显示,第一次送出音频数据,没有发生时为-1
+  double open_seconds{-1};
+  double time_to_first_frame{-1};
+  double time_to_first_audio{-1};
+  //是否命中了流信息缓存
+  bool stream_cache_hit{false};
+  //直播模式下数据断流后重新缓冲的次数,以及延迟太大直接跳到目标延迟的次数
+  uint64_t live_underruns{0};
+  uint64_t live_jumps{0};
+  //录制的统计,没有录制时都是0
+  RecorderStats record;
+  //逐帧步进和倒放的GOP缓存,没有步进过时都是0
+  GopCacheStats gop_cache;
+  //最近一次继续播放时停下的画面的pts,以及继续播放后显示的第一帧的pts,两者应该相同;没有时为NAN
+  double resume_pts{NAN};
+  double resume_first_pts{NAN};
+  //各阶段线程消耗的cpu时间(秒),线程结束后才有值
+  double demux_cpu{0};
+  double video_decode_cpu{0};
+  double audio_decode_cpu{0};
+  double video_sink_cpu{0};
+  double audio_sink_cpu{0};
+};
+
 class MediaPlayer {
-  using PacketQueue = std::queue<AVPacket*>;
-  using FrameQueue = std::queue<Frame>;
+  //每一对相邻的线程之间都是单生产者单消费者,所以使用无锁环形队列
+  using PacketQueue = MediaQueue<Packet>;
+  using FrameQueue = MediaQueue<Frame>;
+  using PacketPool = ObjectPool<AVPacket, av_packet_alloc, av_packet_free, av_packet_unref>;
+  using FramePool = ObjectPool<AVFrame, av_frame_alloc, av_frame_free, av_frame_unref>;
 public:
   // 打开媒体文件并初始化
-  MediaPlayer(const char *url, AV_SYNC_TYPE av_sync_type = DEFAULT_AV_SYNC_TYPE);
+  MediaPlayer(const char *url, AV_SYNC_TYPE av_sync_type = DEFAULT_AV_SYNC_TYPE,
+              const PlayerOptions &options = PlayerOptions());
   ~MediaPlayer();
+  //start_async()然后wait()
   void start();
+  //启动各个线程或者向执行器提交任务,立即返回
+  void start_async();
+  //等待播放结束并输出统计
+  void wait();
+  //结束播放,可以在任意线程调用;阻塞在队列上和等待显示时间的线程都会立刻被唤醒,wait()随后返回
+  void quit();
+  //跳转到pos秒(和pts同一个时间轴),rel是相对于当前位置的偏移,决定往哪个方向找关键帧;可以在任意线程调用
+  void seek(double pos, double rel = 0);
+  //逐帧步进:暂停正常播放,从当前画面往后(frames>0)或往前移动frames帧;可以在任意线程调用
+  void step(int frames);
+  //开始/停止倒放,倒放时同样暂停正常播放,停止后停在当前画面
+  void play_reverse(bool on);
+  //退出步进和倒放,从当前画面的位置继续正常播放
+  void resume();
+  //媒体时长(秒),未知时返回0
+  double duration() const;
+  //缩略图模式:不用start(),只解码均匀分布的关键帧,分段多线程并行,输出雪碧图和时间戳映射
+  bool extract_thumbnails(const ThumbnailOptions &opts, ThumbnailStats *stats = nullptr);
+  //构造函数是否成功打开了媒体文件
+  bool is_opened() const { return opened; }
+  //AVFrame/AVPacket外壳的累计分配次数,稳定播放后不应该再增长
+  uint64_t shell_allocations() const;
+  //各队列的当前深度和最高水位
+  PipelineStats stats() const;
+  //各阶段耗时直方图和队列深度分布
+  const PlayerMetrics &get_metrics() const { return metrics; }
+  std::string stats_json() const;
+  void dump_stats();
   // 读取数据,从视频流读取数据包packet并解码到frame中,并且转换成对应的格式存储起来
   void readData();
-  int decode_packet(AVCodecContext* codecCtx, AVPacket* packet);
+  int decode_packet(AVCodecContext* codecCtx, AVPacket* packet, int serial);
+  //重采样并做同步修正后写入PCM环形缓冲区
+  int write_audio_frame(AVFrame *frame, double pts, int serial);
   int packet_queue_put();
 
   //音频sdl回调函数
   void audioDataRead(void *userdata, Uint8 *stream, int len);
   static void audioCallback(void *userdata, Uint8 *stream, int len);
+  //ffmpeg阻塞读取时定期调用,返回非0中止读取
+  static int interruptCallback(void *opaque);
 
   //解码线程
   void video_thread();
   void audio_thread();
+  //paced为true时按声卡的节奏拉取数据
+  void null_audio_sink(bool paced);
+  //打开声卡,和解码并行进行,失败时退化成按节奏拉取的null_audio_sink
+  void open_audio_device();
+  void stats_thread();
   
   //音视频同步
   double synchronize_video(AVFrame *frame, double pts);
@@ -66,17 +273,86 @@ public:
   double get_video_clock();
   double get_master_clock();
   double get_external_clock();
-  int synchronize_audio(short *samples, int samples_size, double pts);
+  //返回这一帧同步修正后希望输出的采样数
+  int synchronize_audio(int nb_samples);
 
 private:
   // 开辟空间存储数据
   void allocFrame();
   void sdl_init();
   void showFrame();
+  int upload_frame(AVFrame *frame);
+  AVFrame *convert_frame(AVFrame *frame);
+  SwsContext *create_sws_context(const AVFrame *frame);
+  void print_decode_threading();
+  //按output_width/output_height算出输出大小,并选择解码器的lowres,在打开解码器之前调用
+  void choose_output_size();
+  //探测流信息,有有效的缓存时只做很小的探测
+  bool probe_stream_info();
+  //在readData线程里执行seek请求
+  void do_seek();
+  //加载关键帧索引,没有或者已经失效时启动后台线程建立
+  void init_keyframe_index();
+  //sync_trace不为空时记录一帧视频的同步参数
+  void trace_video(double pts, double ref_clock, double delay, double actual_delay, bool dropped);
+  //一帧显示出来之后更新时钟和统计
+  void frame_presented(double pts, int serial);
+  //丢掉seek之前的旧帧,seek之后的第一帧重新开始计时;返回false表示这一帧已经丢掉了
+  bool accept_frame(Frame &vf);
+  //处理步进和倒放的请求,在这个模式里时代替从帧队列取帧显示,返回false表示正常播放
+  bool scrub();
+  //进入步进模式:暂停声卡,第一次时创建GOP缓存
+  bool enter_scrub();
+  //从GOP缓存里取出当前画面往后/往前offset帧的那一帧显示出来,没有移动(到了头)或者失败返回false
+  bool show_cached(int offset);
+  //无头且不限速时的显示:只做格式转换,失败返回false
+  bool present_unpaced(Frame &vf);
+  //各阶段处理一个数据的部分,专用线程和执行器上的任务共用;seek请求由调用者在读包之前处理
+  bool demux_one();
+  void finish_demux();
+  //在两个包队列末尾放结束标记,每个serial放一次;执行器上放不进去时返回false,下次再试
+  bool send_eof();
+  //读到末尾之后等seek或者quit(),最多等QUEUE_POP_TIMEOUT
+  void wait_seek_or_quit();
+  bool queue_eof(PacketQueue &q);
+  //收到结束标记:冲出解码器里剩下的帧,然后通知下游
+  void video_eof(int serial);
+  //执行器上把视频帧放进帧队列,放不进去时先留在pending_frames里;按顺序放完返回true
+  void queue_frame(const Frame &item, int64_t bytes, double duration);
+  bool flush_pending_frames();
+  void audio_eof(int serial);
+  //当前serial的音频都已经解码完,并且从环形缓冲区里读走了
+  bool audio_finished() const;
+  //睡到target(单调时钟),返回醒来的时间;期间quit()了立刻返回NAN
+  double sleep_until_or_quit(double target);
+  void poll_events();
+  void video_packet(Packet &p);
+  void audio_packet(Packet &p);
+  void stats_sample();
+  void print_summary();
+  //执行器上的任务,每一步最多处理EXECUTOR_STEP_BUDGET个数据
+  TaskStatus demux_step();
+  TaskStatus video_decode_step();
+  TaskStatus audio_decode_step();
+  TaskStatus video_sink_step();
+  TaskStatus audio_sink_step();
+  //缩略图模式的一个线程:单独打开一份文件,依次seek到[begin, end)这几张缩略图的位置,缩放后写进雪碧图的格子
+  void thumbnail_segment(const std::vector<double> &times, int begin, int end,
+                         AVFrame *sheet, int cell_w, int cell_h, std::vector<char> &filled, ThumbnailStats &st);
+  //提交流水线任务,每一步的cpu时间累加到cpu
+  void submit_task(TaskStatus (MediaPlayer::*step)(), double *cpu);
+  void task_finished(int &count);
+  //直播模式下readData每读到一个包调用一次,按数据到达的情况调整外部时钟
+  void live_update();
 
   // 初始化部分
   const char *url_;
+  PlayerOptions options_;
   AVFormatContext *pFormatCtx{NULL};
+  //options_.mmap_io时代替默认file协议的读取层,要在pFormatCtx关闭之后才能释放
+  std::unique_ptr<MmapIO> mmap_reader;
+  //options_.record_path不为空时的录制,读包线程往里放包
+  std::unique_ptr<Recorder> recorder;
   // 一路流
   AVStream *vStream{NULL};
   AVStream *aStream{NULL};
@@ -98,6 +374,17 @@ private:
   // 数据包
   AVPacket *packet;
   struct SwsContext *sws_ctx{NULL};
+  //纹理上传统计,只在渲染线程里访问
+  int64_t upload_direct_count{0};
+  int64_t upload_convert_count{0};
+  std::chrono::steady_clock::duration upload_time{0};
+  //输出画面的大小,窗口、纹理和pFrameYUV都是这个大小
+  int out_width{0};
+  int out_height{0};
+  //当前sws_ctx对应的输入格式,变化时需要重建
+  int sws_src_width{0};
+  int sws_src_height{0};
+  int sws_src_format{AV_PIX_FMT_NONE};
 
   // sdl部分
   SDL_Surface *screen{NULL};
@@ -111,67 +398,194 @@ private:
   SDL_Rect *rect{NULL};
   // 事件
   SDL_Event event;
-  //结束符号
-  bool is_close{false};
+  //quit()请求结束;正常播完时渲染端等画面和声音都放完也调用quit(),让等在末尾的读包和解码线程退出
+  std::atomic_bool is_close{false};
+  //quit()时唤醒正在等待显示时间的渲染线程
+  FutexEvent quit_event;
+  //读包读到末尾后等在这里,seek()和quit()唤醒
+  FutexEvent demux_event;
+  //当前serial的结束标记是否已经放进了包队列,seek时重置,只在读包的线程/任务里访问
+  bool video_eof_sent{false};
+  bool audio_eof_sent{false};
+  //执行器上没放进帧队列的视频帧和结束标记,冲解码器时一次会吐出很多帧,不能丢;只在视频解码任务里访问
+  struct PendingFrame
+  {
+    Frame item;
+    int64_t bytes;
+    double duration;
+  };
+  std::deque<PendingFrame> pending_frames;
+  bool opened{false};
 
-  PacketQueue vPacket_queue;
-  PacketQueue aPacket_queue;
-  FrameQueue vFrame_queue;
-  FrameQueue aFrame_queue;
+  //readData -> video_thread
+  PacketQueue vPacket_queue{MAX_QUEUE_SIZE, options_.video_packet_limits};
+  //readData -> audio_thread
+  PacketQueue aPacket_queue{MAX_QUEUE_SIZE, options_.audio_packet_limits};
+  //video_thread -> showFrame
+  FrameQueue vFrame_queue{MAX_QUEUE_SIZE, options_.video_frame_limits};
+  //audio_thread -> 音频回调,重采样和同步修正后的PCM数据,容量在打开音频后才知道
+  std::unique_ptr<PcmRing> pcm_ring;
+  //PCM数据流里每一帧结束处的偏移和pts,音频回调用它算出正在播放的位置
+  struct PcmMark
+  {
+    uint64_t start_offset;
+    uint64_t end_offset;
+    double end_pts;
+    int serial;
+  };
+  SpscQueue<PcmMark> pcm_marks{MAX_QUEUE_SIZE};
+  //以下两个只在音频回调里访问:最近一个已经播放完的标记
+  PcmMark last_mark{0, 0, 0.0, 0};
+  bool has_mark{false};
+  std::atomic<uint64_t> pcm_high_water{0};
+  //和上面的队列一一对应的对象池,队列里的对象用完后还给对应的池子
+  PacketPool vPacket_pool{MAX_QUEUE_SIZE + POOL_SLACK};
+  PacketPool aPacket_pool{MAX_QUEUE_SIZE + POOL_SLACK};
+  FramePool vFrame_pool{MAX_QUEUE_SIZE + POOL_SLACK};
+  FramePool aFrame_pool{MAX_QUEUE_SIZE + POOL_SLACK};
+  //已经解码出来的帧数,和shell_allocations对比
+  std::atomic<uint64_t> decoded_frames{0};
+  std::atomic<uint64_t> drained_frames{0};
+  //送入视频解码器的包数和第一帧输出前的包数,只在视频解码线程访问
+  int64_t video_packets_sent{0};
+  int64_t first_video_frame_packets{-1};
+  //吞吐量计数
+  std::atomic<uint64_t> demux_bytes{0};
+  std::atomic<uint64_t> rendered_frames{0};
+  std::atomic<uint64_t> audio_samples{0};
+  std::atomic<uint64_t> frames_dropped{0};
+  std::atomic<uint64_t> frames_late{0};
+  std::atomic<uint64_t> audio_compensated_frames{0};
+  std::atomic<uint64_t> audio_fast_frames{0};
+  //以下两个只在渲染线程访问:连续丢帧数,显示一帧的平均开销(秒)
+  int consecutive_drops{0};
+  double render_cost_avg{0.0};
+  //各线程退出前写入自己的cpu时间
+  double demux_cpu{0};
+  double video_decode_cpu{0};
+  double audio_decode_cpu{0};
+  double video_sink_cpu{0};
+  double audio_sink_cpu{0};
+  //运行时指标,所有线程都会写入
+  PlayerMetrics metrics;
+  //按键请求输出统计
+  std::atomic_bool dump_stats_req{false};
+  //流水线线程都已经退出,统计线程可以结束了
+  std::atomic_bool pipeline_done{false};
+  //解码线程已经退出(quit()之后),不会再有新的帧;读到末尾时解码线程不退出,seek之后还要接着解码
+  std::atomic_bool audio_decode_done{false};
+  std::atomic_bool video_decode_done{false};
 
   // sdl音频部分
   SDL_AudioSpec wanted_spec;
   SDL_AudioSpec spec;
   SDL_AudioCallback audio_callback{NULL};
+  //每个播放器打开自己的音频设备;初始化过的sdl子系统,析构时只退出这些
+  SDL_AudioDeviceID audio_dev{0};
+  bool sdl_video_inited{false};
+  bool sdl_audio_inited{false};
   //音频格式转换部分
   SwrContext *swr_ctx{NULL};
-  //音频格式转换时的缓冲区
+  //不需要伸缩采样数时的格式转换函数,打开时按采样格式和声道数选好,为空时全部交给swr
+  AudioConverter audio_converter;
+  //增益不为1时swr的输出再乘一次增益(原地转换)
+  AudioConverter swr_gain;
+  //音频当前是否经过swr、连续多少帧不需要补偿、上次切回直接转换时swr里留下的采样数;只在音频解码线程访问
+  bool swr_active{false};
+  int swr_idle_frames{0};
+  int swr_stale_samples{0};
+  //音频格式转换时的缓冲区,只在音频解码线程使用,按需用av_fast_malloc扩大
   uint8_t *audio_buf = nullptr;
-  //当前播放音频帧的位置
-  std::atomic_int audio_buf_index{0};//配合buf使用
-  //当前播放音频帧的大小
-  std::atomic_int audio_buf_size{0};//配合buf使用
+  unsigned int audio_buf_alloc{0};
   
 
   //线程
   std::vector<std::thread> th;
-  //读取得到原始Packet锁和条件变量
-  std::mutex video_Packet_mtx;
-  std::mutex audio_Packet_mtx;
-  std::condition_variable video_Packet_cond;
-  std::condition_variable audio_Packet_cond;
-  //解码得到的帧锁和条件变量
-  std::mutex video_Frame_mtx;
-  std::mutex audio_Frame_mtx;
-  std::condition_variable video_Frame_cond;
-  std::condition_variable audio_Frame_cond;
+  std::thread monitor;
+  //执行器模式下还没有结束的流水线任务和统计任务
+  std::mutex tasks_mutex;
+  std::condition_variable tasks_cv;
+  int pipeline_tasks{0};
+  int stats_tasks{0};
+  //audio_sink_step的输出缓冲区
+  std::vector<Uint8> sink_buf;
+  //统计线程/任务处理过的输出请求和下一次定时输出的时间
+  uint64_t stats_seen_generation{0};
+  std::chrono::steady_clock::time_point next_stats_dump;
 
 
   AV_SYNC_TYPE av_sync_type;
+  //三个时钟都基于单调时钟
+  Clock audclk;//音频回调写
+  Clock vidclk;//渲染线程写
+  Clock extclk;//渲染线程写,跟随音频/视频时钟;直播模式下由readData按数据到达的速度写
   //音频为主的视频同步
-  struct timeval start_time;
-  struct timeval cur_time;
   double video_clock{0.0};//上一帧的pts/预测下一帧的pts
-  std::atomic<double> audio_clock{0.0};//音频已经播放出去的时间
   //记录上一帧的pts和延迟
   double frame_last_pts{0.0};
   double frame_last_delay{40e-3};
-  //frame_timer会一直累加在播放过程中计算的延时，和系统时间做比较
+  //frame_timer会一直累加在播放过程中计算的延时，和单调时钟比较,是下一帧应该显示的绝对时间
   double frame_timer{0.0};
 
   //视频为主的视频同步
-  double video_current_pts{0.0};
-  struct timeval video_current_pts_time;
   double audio_diff_cum{0.0};//加权平均值
   int audio_diff_avg_count{0};
   double audio_diff_avg_coef{0.0};//权重系数.越高表示过去的数据权重越高
   double audio_diff_threshold{0.1};
 
   //seek操作
-  int seek_req;
-  int seek_flags;
-  int64_t seek_pos;
-  double incr, pos;
+  std::atomic_bool seek_req{false};
+  std::atomic<int64_t> seek_pos{0};//AV_TIME_BASE为单位
+  std::atomic<int64_t> seek_rel{0};
+  double incr{0}, pos{0};
+  //当前的serial,只有readData在seek成功后修改
+  std::atomic_int serial{0};
+  //逐帧步进和倒放:请求可以来自任意线程,其余只在渲染线程访问
+  std::atomic_int step_req{0};
+  std::atomic_bool reverse_req{false};
+  std::atomic_bool resume_req{false};
+  bool scrubbing{false};
+  //当前显示的缓存帧的pts,以及倒放时下一帧的显示时间
+  double scrub_pts{NAN};
+  double reverse_next{0};
+  AVFrame *scrub_frame{NULL};
+  //GOP缓存,gop_cache_ready之后才能在其它线程访问
+  std::unique_ptr<GopCache> gop_cache;
+  std::atomic_bool gop_cache_ready{false};
+  //最近一次seek的目标时间(秒),精确seek时解码线程丢掉它之前的帧;不是精确seek,或者seek之后的画面和声音都已经显示/播放时为NAN
+  std::atomic<double> seek_target{NAN};
+  //下一次seek按精确seek处理(从步进继续播放时),由do_seek取走
+  std::atomic_bool seek_accurate_req{false};
+  //最近显示出来的一帧的pts,只在渲染线程访问
+  double shown_pts{NAN};
+  //继续播放时停下的画面和之后显示的第一帧,resume_serial是继续播放之前的serial
+  std::atomic<double> resume_pts{NAN};
+  std::atomic<double> resume_first_pts{NAN};
+  int resume_serial{-1};
+  std::atomic<double> seek_request_time{0.0};
+  //各线程自己看到的serial,变化时说明发生了seek
+  int video_decoder_serial{0};
+  int audio_decoder_serial{0};
+  int frame_serial{0};
+  //音频解码器冲完了哪个serial的数据;渲染端显示到了哪个serial的结束标记(只在渲染线程/任务里访问)
+  std::atomic_int audio_eof_serial{-1};
+  int video_end_serial{-1};
+  //关键帧索引,index_ready之后才能访问
+  std::unique_ptr<KeyframeIndex> keyframe_index;
+  std::atomic_bool index_ready{false};
+  std::atomic_bool index_cancel{false};
+  std::thread index_thread;
+  std::atomic<uint64_t> indexed_seeks{0};
+  //启动耗时,都是单调时钟上的时间点
+  double open_begin{0};
+  double open_end{0};
+  std::atomic<double> first_frame_time{NAN};
+  std::atomic<double> first_audio_time{NAN};
+  bool stream_cache_hit{false};
+  //直播模式:收到的最新数据的pts(秒),外部时钟不会走到它后面
+  std::atomic<double> live_arrival{NAN};
+  std::atomic<uint64_t> live_underruns{0};
+  std::atomic<uint64_t> live_jumps{0};
 };
  
 
@@ -0,0 +1,202 @@
+#include "recorder.h"
+#include <iostream>
+
+namespace
+{
+  //队列的槽位数,实际的上限由字节数和时长决定
+  const int RECORD_QUEUE_SLOTS = 2048;
+  //录制线程等待新包的超时时间,结束靠结束标记,这里只是兜底
+  const std::chrono::milliseconds RECORD_POP_TIMEOUT(100);
+}
+
+Recorder::Recorder(const std::string &path, const AVFormatContext *input, int video_index, int audio_index,
+                   QueueLimits limits)
+  : path_(path), video_index_(video_index), queue_(RECORD_QUEUE_SLOTS, limits), pool_(RECORD_QUEUE_SLOTS + 16)
+{
+  //按扩展名选择封装格式
+  if(avformat_alloc_output_context2(&out_, NULL, NULL, path.c_str()) < 0 || !out_)
+  {
+    std::cerr << "不支持的录制格式:" << path << std::endl;
+    return;
+  }
+  stream_map_.assign(input->nb_streams, -1);
+  input_time_base_.resize(input->nb_streams);
+  default_duration_.assign(input->nb_streams, 0);
+  for(int index : {video_index, audio_index})
+  {
+    if(index < 0)
+    {
+      continue;
+    }
+    AVStream *in = input->streams[index];
+    AVStream *st = avformat_new_stream(out_, NULL);
+    if(!st || avcodec_parameters_copy(st->codecpar, in->codecpar) < 0)
+    {
+      std::cerr << "创建录制的输出流失败" << std::endl;
+      return;
+    }
+    //不同容器的codec_tag不通用,让muxer自己选
+    st->codecpar->codec_tag = 0;
+    st->time_base = in->time_base;
+    stream_map_[index] = st->index;
+    input_time_base_[index] = in->time_base;
+    if(index == video_index && in->avg_frame_rate.num > 0)
+    {
+      default_duration_[index] = av_q2d(av_inv_q(in->avg_frame_rate));
+    }
+    else if(index == audio_index && in->codecpar->frame_size > 0 && in->codecpar->sample_rate > 0)
+    {
+      default_duration_[index] = (double)in->codecpar->frame_size / in->codecpar->sample_rate;
+    }
+  }
+  last_dts_.assign(out_->nb_streams, AV_NOPTS_VALUE);
+  if(!(out_->oformat->flags & AVFMT_NOFILE) && avio_open(&out_->pb, path.c_str(), AVIO_FLAG_WRITE) < 0)
+  {
+    std::cerr << "打开录制文件失败:" << path << std::endl;
+    return;
+  }
+  if(avformat_write_header(out_, NULL) < 0)
+  {
+    std::cerr << "写入录制文件头失败:" << path << std::endl;
+    return;
+  }
+  opened_ = true;
+  thread_ = std::thread(&Recorder::run, this);
+}
+
+Recorder::~Recorder()
+{
+  finish();
+  if(out_)
+  {
+    if(!(out_->oformat->flags & AVFMT_NOFILE))
+    {
+      avio_closep(&out_->pb);
+    }
+    avformat_free_context(out_);
+  }
+}
+
+void Recorder::put(const AVPacket *pkt)
+{
+  if(!opened_ || finished_ || pkt->stream_index >= (int)stream_map_.size() || stream_map_[pkt->stream_index] < 0)
+  {
+    return;
+  }
+  bool video = pkt->stream_index == video_index_;
+  if(video && wait_keyframe_)
+  {
+    if(!(pkt->flags & AV_PKT_FLAG_KEY))
+    {
+      packets_dropped_++;
+      return;
+    }
+    wait_keyframe_ = false;
+  }
+  //录制跟不上就丢包,不能让读包线程等磁盘
+  if(queue_.over_limit())
+  {
+    packets_dropped_++;
+    wait_keyframe_ = wait_keyframe_ || video;
+    return;
+  }
+  //新的外壳引用同一块数据,不拷贝
+  AVPacket *ref = pool_.acquire();
+  if(!ref || av_packet_ref(ref, pkt) < 0)
+  {
+    pool_.put_back(ref);
+    packets_dropped_++;
+    wait_keyframe_ = wait_keyframe_ || video;
+    return;
+  }
+  double duration = pkt->duration * av_q2d(input_time_base_[pkt->stream_index]);
+  //flv之类的格式经常不带包时长,算成0的话队列的时长上限就不起作用,用估算的时长
+  if(duration <= 0)
+  {
+    duration = default_duration_[pkt->stream_index];
+  }
+  if(!queue_.try_push(ref, ref->size, duration))
+  {
+    pool_.put_back(ref);
+    packets_dropped_++;
+    wait_keyframe_ = wait_keyframe_ || video;
+  }
+}
+
+void Recorder::finish()
+{
+  if(!opened_ || finished_)
+  {
+    return;
+  }
+  finished_ = true;
+  //结束标记不能丢,等录制线程腾出槽位
+  while(!queue_.push(nullptr, 0, 0, RECORD_POP_TIMEOUT))
+  {
+  }
+  thread_.join();
+  av_write_trailer(out_);
+  RecorderStats st = stats();
+  std::cout << "录制结束:" << path_ << " 写入" << st.packets_written << "个包 " << st.bytes_written / (1024.0 * 1024.0)
+            << "MB 丢弃" << st.packets_dropped << "个 时间戳倒退跳过" << st.packets_skipped << "个" << std::endl;
+}
+
+RecorderStats Recorder::stats() const
+{
+  RecorderStats st;
+  st.packets_written = packets_written_;
+  st.bytes_written = bytes_written_;
+  st.packets_dropped = packets_dropped_;
+  st.packets_skipped = packets_skipped_;
+  return st;
+}
+
+void Recorder::run()
+{
+  while(true)
+  {
+    AVPacket *pkt = nullptr;
+    if(!queue_.pop(pkt, RECORD_POP_TIMEOUT))
+    {
+      continue;
+    }
+    if(!pkt)
+    {
+      break;
+    }
+    write(pkt);
+    pool_.release(pkt);
+  }
+}
+
+void Recorder::write(AVPacket *pkt)
+{
+  int in_index = pkt->stream_index;
+  int out_index = stream_map_[in_index];
+  AVStream *st = out_->streams[out_index];
+  av_packet_rescale_ts(pkt, input_time_base_[in_index], st->time_base);
+  pkt->stream_index = out_index;
+  pkt->pos = -1;
+  //seek之后时间戳会倒退,容器要求dts单调递增,倒退的包跳过,直到追上录过的位置
+  int64_t &last = last_dts_[out_index];
+  if(pkt->dts != AV_NOPTS_VALUE && last != AV_NOPTS_VALUE &&
+     (pkt->dts < last || (pkt->dts == last && !(out_->oformat->flags & AVFMT_TS_NONSTRICT))))
+  {
+    packets_skipped_++;
+    return;
+  }
+  if(pkt->dts != AV_NOPTS_VALUE)
+  {
+    last = pkt->dts;
+  }
+  int size = pkt->size;
+  //av_interleaved_write_frame接管数据的引用,返回后pkt是空的,外壳还给对象池
+  int ret = av_interleaved_write_frame(out_, pkt);
+  if(ret < 0)
+  {
+    packets_skipped_++;
+    return;
+  }
+  packets_written_++;
+  bytes_written_ += size;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include "media_queue.h"
+#include "object_pool.h"
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+//录制的累计统计
+struct RecorderStats
+{
+  uint64_t packets_written{0};
+  uint64_t bytes_written{0};
+  //缓冲区满丢掉的包,以及丢包后等待下一个视频关键帧期间跳过的包
+  uint64_t packets_dropped{0};
+  //seek之后时间戳倒退,容器写不进去而跳过的包
+  uint64_t packets_skipped{0};
+};
+
+/*
+ * 边播边录
+ * 读包线程把读到的每个包增加一次引用放进有界队列,不拷贝数据也不重新编码,录制线程按输出文件的扩展名(flv/mp4/mkv...)重新封装
+ * 队列满了(磁盘太慢)就丢包,保证读包线程不会因为录制而阻塞;丢了视频包之后等到下一个关键帧再继续录,避免录下来的文件花屏
+ */
+class Recorder {
+public:
+  //按输入里的视频流和音频流创建输出文件并写好文件头,失败时is_opened()返回false
+  Recorder(const std::string &path, const AVFormatContext *input, int video_index, int audio_index, QueueLimits limits);
+  ~Recorder();
+  Recorder(const Recorder &) = delete;
+  Recorder &operator=(const Recorder &) = delete;
+
+  bool is_opened() const { return opened_; }
+  //读包线程调用,只增加引用计数,队列满了直接丢掉
+  void put(const AVPacket *pkt);
+  //放入结束标记,等录制线程把剩下的包写完,然后写文件尾,可以重复调用
+  void finish();
+  RecorderStats stats() const;
+
+private:
+  using PacketPool = ObjectPool<AVPacket, av_packet_alloc, av_packet_free, av_packet_unref>;
+
+  void run();
+  void write(AVPacket *pkt);
+
+  std::string path_;
+  AVFormatContext *out_{nullptr};
+  bool opened_{false};
+  bool finished_{false};
+  //输入流下标 -> 输出流下标,不录的流是-1
+  std::vector<int> stream_map_;
+  std::vector<AVRational> input_time_base_;
+  //包不带时长时(flv之类)按帧率/每帧采样数估算的时长(秒),估算不出来是0
+  std::vector<double> default_duration_;
+  int video_index_{-1};
+  //丢过视频包,下一个视频关键帧之前的包都不录;只在读包线程访问
+  bool wait_keyframe_{false};
+  //每路输出流最后写入的dts,只在录制线程访问
+  std::vector<int64_t> last_dts_;
+  //读包线程 -> 录制线程,空指针是结束标记
+  MediaQueue<AVPacket *> queue_;
+  PacketPool pool_;
+  std::thread thread_;
+  std::atomic<uint64_t> packets_written_{0};
+  std::atomic<uint64_t> bytes_written_{0};
+  std::atomic<uint64_t> packets_dropped_{0};
+  std::atomic<uint64_t> packets_skipped_{0};
+};
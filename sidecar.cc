@@ -0,0 +1,35 @@
+#include "sidecar.h"
+#include <algorithm>
+#include <cstdlib>
+#include <sys/stat.h>
+
+bool file_identity(const std::string &path, int64_t &size, int64_t &mtime_ns)
+{
+  struct stat st;
+  if(stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+  {
+    return false;
+  }
+  size = st.st_size;
+  mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  return true;
+}
+
+std::string sidecar_path(const std::string &media_path, const std::string &dir, const char *ext)
+{
+  int64_t size, mtime;
+  if(!file_identity(media_path, size, mtime))
+  {
+    return "";
+  }
+  if(dir.empty())
+  {
+    return media_path + ext;
+  }
+  //缓存目录里用绝对路径做文件名,把'/'换掉
+  char *real = realpath(media_path.c_str(), NULL);
+  std::string name = real ? real : media_path;
+  free(real);
+  std::replace(name.begin(), name.end(), '/', '_');
+  return dir + "/" + name + ext;
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+//本地媒体文件的身份(大小和修改时间),用来判断放在旁边的sidecar缓存是否还有效;不是普通文件返回false
+bool file_identity(const std::string &path, int64_t &size, int64_t &mtime_ns);
+
+//sidecar文件路径: dir为空时放在媒体文件旁边,否则放在dir里并用绝对路径做文件名;不是本地文件返回空字符串
+std::string sidecar_path(const std::string &media_path, const std::string &dir, const char *ext);
@@ -0,0 +1,246 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <vector>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//缓存行大小,读写下标分开放在不同的缓存行上,避免生产者和消费者互相把对方的缓存行弄失效(伪共享)
+constexpr size_t CACHELINE_SIZE = 64;
+
+/*
+ * 基于futex的事件通知
+ * 等待方先读取seq,再检查条件,条件不满足才futex_wait(seq)
+ * 通知方只有在有人等待时才会真正进入内核,没人等待时只是一次原子加法
+ */
+class FutexEvent {
+public:
+  uint32_t prepare_wait()
+  {
+    waiters_.fetch_add(1, std::memory_order_seq_cst);
+    uint32_t seq = seq_.load(std::memory_order_seq_cst);
+    //之后对条件的检查不能被重排到这里之前
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return seq;
+  }
+  void cancel_wait()
+  {
+    waiters_.fetch_sub(1, std::memory_order_seq_cst);
+  }
+  //timeout为负数表示一直等待
+  void wait(uint32_t seq, std::chrono::milliseconds timeout)
+  {
+    struct timespec ts;
+    struct timespec *pts = nullptr;
+    if(timeout.count() >= 0)
+    {
+      ts.tv_sec = timeout.count() / 1000;
+      ts.tv_nsec = (timeout.count() % 1000) * 1000000;
+      pts = &ts;
+    }
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq_), FUTEX_WAIT_PRIVATE, seq, pts, nullptr, 0);
+    waiters_.fetch_sub(1, std::memory_order_seq_cst);
+  }
+  void notify()
+  {
+    seq_.fetch_add(1, std::memory_order_seq_cst);
+    if(waiters_.load(std::memory_order_seq_cst) > 0)
+    {
+      syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq_), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    }
+  }
+
+private:
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex需要32位的原子变量");
+  std::atomic<uint32_t> seq_{0};
+  std::atomic<uint32_t> waiters_{0};
+};
+
+/*
+ * 有界的单生产者单消费者无锁环形队列
+ * 只允许一个线程push,一个线程pop
+ * 只有在 空->非空 时唤醒消费者, 满->非满 时唤醒生产者
+ */
+template <typename T>
+class SpscQueue {
+public:
+  //容量会向上取整到2的幂,方便用位运算取下标
+  explicit SpscQueue(size_t capacity)
+  {
+    size_t cap = 2;
+    while(cap < capacity)
+    {
+      cap <<= 1;
+    }
+    mask_ = cap - 1;
+    buf_.resize(cap);
+  }
+  SpscQueue(const SpscQueue &) = delete;
+  SpscQueue &operator=(const SpscQueue &) = delete;
+
+  //生产者调用,满了返回false
+  bool try_push(const T &item)
+  {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if(tail - head_cache_ > mask_)
+    {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if(tail - head_cache_ > mask_)
+      {
+        return false;
+      }
+    }
+    buf_[tail & mask_] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+    //和消费者的pop形成Dekker同步,保证要么我们看到消费者更新的head,要么消费者看到新的tail
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(head_.load(std::memory_order_relaxed) == tail)
+    {
+      not_empty_.notify();
+    }
+    return true;
+  }
+
+  //生产者调用,队列满时阻塞等待,超时返回false
+  bool push(const T &item, std::chrono::milliseconds timeout)
+  {
+    while(!try_push(item))
+    {
+      if(closed_)
+      {
+        return false;
+      }
+      uint32_t seq = not_full_.prepare_wait();
+      if(!full() || closed_)
+      {
+        not_full_.cancel_wait();
+        continue;
+      }
+      not_full_.wait(seq, timeout);
+      if(full())
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  //消费者调用,空了返回false
+  bool try_pop(T &item)
+  {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if(head == tail_cache_)
+    {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
+      if(head == tail_cache_)
+      {
+        return false;
+      }
+    }
+    item = buf_[head & mask_];
+    head_.store(head + 1, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    //pop之前是满的,说明生产者可能在等待
+    if(tail_.load(std::memory_order_relaxed) - head > mask_)
+    {
+      not_full_.notify();
+    }
+    return true;
+  }
+
+  //消费者调用,队列空时阻塞等待,超时返回false
+  bool pop(T &item, std::chrono::milliseconds timeout)
+  {
+    while(!try_pop(item))
+    {
+      if(closed_)
+      {
+        return false;
+      }
+      uint32_t seq = not_empty_.prepare_wait();
+      if(!empty() || closed_)
+      {
+        not_empty_.cancel_wait();
+        continue;
+      }
+      not_empty_.wait(seq, timeout);
+      if(empty())
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  //消费者调用,等待队列非空但不取出数据,超时返回false
+  bool wait(std::chrono::milliseconds timeout)
+  {
+    if(!empty() || closed_)
+    {
+      return !empty();
+    }
+    uint32_t seq = not_empty_.prepare_wait();
+    if(!empty() || closed_)
+    {
+      not_empty_.cancel_wait();
+      return !empty();
+    }
+    not_empty_.wait(seq, timeout);
+    return !empty();
+  }
+
+  //消费者调用,查看队首但不取出
+  T *front()
+  {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if(head == tail_.load(std::memory_order_acquire))
+    {
+      return nullptr;
+    }
+    return &buf_[head & mask_];
+  }
+
+  //唤醒所有等待者,用于关闭时让阻塞的线程退出
+  void wake_all()
+  {
+    not_empty_.notify();
+    not_full_.notify();
+  }
+
+  //关闭队列:之后push/pop/wait不再阻塞,已经在等待的线程立刻返回;队列里剩下的数据仍然可以try_pop取出
+  void close()
+  {
+    closed_.store(true, std::memory_order_seq_cst);
+    wake_all();
+  }
+  bool closed() const { return closed_.load(); }
+
+  size_t size() const
+  {
+    //先读head再读tail,保证结果不会因为并发pop而下溢
+    size_t head = head_.load(std::memory_order_acquire);
+    return tail_.load(std::memory_order_acquire) - head;
+  }
+  bool empty() const { return size() == 0; }
+  bool full() const { return size() > mask_; }
+  size_t capacity() const { return mask_ + 1; }
+
+private:
+  std::vector<T> buf_;
+  size_t mask_{0};
+  //消费者写的数据
+  alignas(CACHELINE_SIZE) std::atomic<size_t> head_{0};
+  size_t tail_cache_{0};
+  //生产者写的数据
+  alignas(CACHELINE_SIZE) std::atomic<size_t> tail_{0};
+  size_t head_cache_{0};
+  alignas(CACHELINE_SIZE) FutexEvent not_empty_;
+  alignas(CACHELINE_SIZE) FutexEvent not_full_;
+  //和futex的seq一样用seq_cst读写,等待方在prepare_wait之后检查它,不会错过close的唤醒
+  std::atomic_bool closed_{false};
+};
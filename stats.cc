@@ -0,0 +1,159 @@
+#include "stats.h"
+#include <climits>
+#include <csignal>
+#include <cstdio>
+
+namespace
+{
+  std::atomic<uint64_t> g_dump_generation{0};
+
+  //信号处理函数里只能做async-signal-safe的事,无锁原子加法是安全的
+  void on_dump_signal(int)
+  {
+    g_dump_generation.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  const char *STAGE_NAMES[] = {
+    "av_read_frame",
+    "avcodec_send_packet",
+    "avcodec_receive_frame",
+    "sws_scale",
+    "SDL_UpdateYUVTexture",
+    "SDL_RenderPresent",
+    "audioCallback",
+  };
+  static_assert(sizeof(STAGE_NAMES) / sizeof(STAGE_NAMES[0]) == (int)Stage::COUNT, "阶段名称和Stage不一致");
+
+  const char *QUEUE_NAMES[] = {
+    "video_packets",
+    "audio_packets",
+    "video_frames",
+    "audio_pcm_bytes",
+  };
+  static_assert(sizeof(QUEUE_NAMES) / sizeof(QUEUE_NAMES[0]) == (int)QueueId::COUNT, "队列名称和QueueId不一致");
+}
+
+int64_t Histogram::bucket_upper(int index)
+{
+  if(index < SUB_BUCKETS)
+  {
+    return index;
+  }
+  int group = index / SUB_BUCKETS;
+  int sub = index % SUB_BUCKETS;
+  int msb = group + SUB_BITS - 1;
+  uint64_t width = 1ULL << (msb - SUB_BITS);
+  uint64_t lower = (1ULL << msb) | ((uint64_t)sub << (msb - SUB_BITS));
+  uint64_t upper = lower + width - 1;
+  return upper > (uint64_t)LLONG_MAX ? LLONG_MAX : (int64_t)upper;
+}
+
+int64_t Histogram::percentile(double p) const
+{
+  uint64_t n = count();
+  if(n == 0)
+  {
+    return 0;
+  }
+  uint64_t target = (uint64_t)(p * n);
+  if(target >= n)
+  {
+    target = n - 1;
+  }
+  uint64_t seen = 0;
+  for(int i = 0; i < BUCKETS; i++)
+  {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if(seen > target)
+    {
+      //桶上界可能比真实最大值还大,取两者较小值
+      int64_t upper = bucket_upper(i);
+      return upper < max() ? upper : max();
+    }
+  }
+  return max();
+}
+
+std::string PlayerMetrics::to_json() const
+{
+  std::string out = "{\"stages\":{";
+  char buf[256];
+  for(int i = 0; i < (int)Stage::COUNT; i++)
+  {
+    const Histogram &h = stages[i];
+    snprintf(buf, sizeof(buf),
+             "%s\"%s\":{\"count\":%llu,\"mean_us\":%.2f,\"p50_us\":%.2f,\"p90_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f}",
+             i ? "," : "", STAGE_NAMES[i], (unsigned long long)h.count(), h.mean() / 1000.0,
+             h.percentile(0.5) / 1000.0, h.percentile(0.9) / 1000.0, h.percentile(0.99) / 1000.0, h.max() / 1000.0);
+    out += buf;
+  }
+  out += "},\"queue_depth\":{";
+  for(int i = 0; i < (int)QueueId::COUNT; i++)
+  {
+    const Histogram &h = queue_depth[i];
+    snprintf(buf, sizeof(buf), "%s\"%s\":{\"samples\":%llu,\"mean\":%.2f,\"p50\":%lld,\"p99\":%lld,\"max\":%lld}",
+             i ? "," : "", QUEUE_NAMES[i], (unsigned long long)h.count(), h.mean(),
+             (long long)h.percentile(0.5), (long long)h.percentile(0.99), (long long)h.max());
+    out += buf;
+  }
+  out += "}";
+  const char *names[] = {"present_error", "av_drift", "seek_latency", "live_latency"};
+  const Histogram *hists[] = {&present_error, &av_drift, &seek_latency, &live_latency};
+  for(int i = 0; i < 4; i++)
+  {
+    snprintf(buf, sizeof(buf), ",\"%s\":{\"count\":%llu,\"p50_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f}",
+             names[i], (unsigned long long)hists[i]->count(), hists[i]->percentile(0.5) / 1000.0,
+             hists[i]->percentile(0.99) / 1000.0, hists[i]->max() / 1000.0);
+    out += buf;
+  }
+  out += "}";
+  return out;
+}
+
+std::string json_escape(const char *s)
+{
+  std::string out;
+  for(; s && *s; s++)
+  {
+    unsigned char c = (unsigned char)*s;
+    switch(c)
+    {
+    case '"': out += "\\\""; break;
+    case '\\': out += "\\\\"; break;
+    case '\n': out += "\\n"; break;
+    case '\r': out += "\\r"; break;
+    case '\t': out += "\\t"; break;
+    default:
+      if(c < 0x20)
+      {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\u%04x", c);
+        out += buf;
+      }
+      else
+      {
+        out += (char)c;
+      }
+    }
+  }
+  return out;
+}
+
+void install_stats_signal_handler()
+{
+  static std::atomic_bool installed{false};
+  if(installed.exchange(true))
+  {
+    return;
+  }
+  struct sigaction sa = {};
+  sa.sa_handler = on_dump_signal;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGUSR1, &sa, NULL);
+}
+
+uint64_t stats_dump_generation()
+{
+  return g_dump_generation.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/*
+ * 无锁的对数线性直方图
+ * 数值按2的幂分组,每组内部再线性分成SUB_BUCKETS个桶,相对误差不超过1/SUB_BUCKETS
+ * record只有几次relaxed原子加法,可以一直开着
+ */
+class Histogram {
+public:
+  static constexpr int SUB_BITS = 3;
+  static constexpr int SUB_BUCKETS = 1 << SUB_BITS;
+  static constexpr int GROUPS = 64 - SUB_BITS + 1;
+  static constexpr int BUCKETS = GROUPS * SUB_BUCKETS;
+
+  void record(int64_t value)
+  {
+    if(value < 0)value = 0;
+    buckets_[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+    int64_t old = max_.load(std::memory_order_relaxed);
+    while(value > old && !max_.compare_exchange_weak(old, value, std::memory_order_relaxed))
+    {
+    }
+  }
+
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  int64_t max() const { return max_.load(std::memory_order_relaxed); }
+  double mean() const
+  {
+    uint64_t n = count();
+    return n ? (double)sum_.load(std::memory_order_relaxed) / n : 0.0;
+  }
+  //返回第p(0~1)分位所在桶的上界
+  int64_t percentile(double p) const;
+
+private:
+  static int bucket_index(int64_t value)
+  {
+    uint64_t v = (uint64_t)value;
+    if(v < (uint64_t)SUB_BUCKETS)
+    {
+      return (int)v;
+    }
+    int msb = 63 - __builtin_clzll(v);
+    int group = msb - SUB_BITS + 1;
+    int sub = (int)((v >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1));
+    return group * SUB_BUCKETS + sub;
+  }
+  static int64_t bucket_upper(int index);
+
+  std::atomic<uint64_t> buckets_[BUCKETS] = {};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<int64_t> sum_{0};
+  std::atomic<int64_t> max_{0};
+};
+
+//被统计耗时的阶段
+enum class Stage
+{
+  READ_FRAME,
+  SEND_PACKET,
+  RECEIVE_FRAME,
+  SWS_SCALE,
+  UPDATE_TEXTURE,
+  RENDER_PRESENT,
+  AUDIO_CALLBACK,
+  COUNT,
+};
+
+//被采样深度的队列
+enum class QueueId
+{
+  VIDEO_PACKETS,
+  AUDIO_PACKETS,
+  VIDEO_FRAMES,
+  AUDIO_PCM,//PCM环形缓冲区里的字节数
+  COUNT,
+};
+
+//播放器的运行时指标: 各阶段耗时(纳秒)和各队列深度的分布
+struct PlayerMetrics
+{
+  Histogram stages[(int)Stage::COUNT];
+  Histogram queue_depth[(int)QueueId::COUNT];
+  //视频帧实际显示时间和目标时间之差的绝对值(纳秒)
+  Histogram present_error;
+  //视频帧显示时音频时钟和这一帧pts之差的绝对值(纳秒)
+  Histogram av_drift;
+  //从发起seek到新位置第一帧显示出来的时间(纳秒)
+  Histogram seek_latency;
+  //直播模式下收到的最新数据和正在播放的位置之差,即实际的缓冲延迟(纳秒)
+  Histogram live_latency;
+
+  Histogram &stage(Stage s) { return stages[(int)s]; }
+  Histogram &depth(QueueId q) { return queue_depth[(int)q]; }
+  //把所有直方图输出成一个JSON对象
+  std::string to_json() const;
+};
+
+//作用域计时,析构时把耗时记录到直方图里
+class ScopedTimer {
+public:
+  explicit ScopedTimer(Histogram &h) : h_(h), begin_(std::chrono::steady_clock::now()) {}
+  ~ScopedTimer()
+  {
+    h_.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin_).count());
+  }
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+  Histogram &h_;
+  std::chrono::steady_clock::time_point begin_;
+};
+
+//把字符串转义成JSON字符串的内容(不含两边的引号),url和文件名里可能有引号、反斜杠和控制字符
+std::string json_escape(const char *s);
+
+//SIGUSR1触发统计输出,每收到一次信号计数加一,各播放器比较自己上次看到的值来判断是否需要输出
+void install_stats_signal_handler();
+uint64_t stats_dump_generation();
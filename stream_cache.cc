@@ -0,0 +1,225 @@
+#include "stream_cache.h"
+#include "sidecar.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <unistd.h>
+
+namespace
+{
+  const char CACHE_MAGIC[8] = {'S', 'T', 'I', 'N', 'F', 'O', 0, 0};
+  const uint32_t CACHE_VERSION = 1;
+
+  struct StreamCacheHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t nb_streams;
+    int64_t file_size;
+    int64_t mtime_ns;
+  };
+
+  //一路流需要缓存的参数,后面紧跟extradata_size字节的extradata
+  struct CachedStream
+  {
+    int32_t codec_type;
+    int32_t codec_id;
+    uint32_t codec_tag;
+    int32_t format;
+    int64_t bit_rate;
+    int32_t width, height;
+    AVRational sample_aspect_ratio;
+    int32_t profile, level;
+    int32_t sample_rate;
+    int32_t nb_channels;
+    int32_t channel_order;
+    uint64_t channel_mask;
+    int32_t frame_size;
+    AVRational time_base;
+    AVRational avg_frame_rate;
+    int32_t extradata_size;
+  };
+
+  //这路流的参数是不是还缺东西,缺了才用缓存补
+  bool incomplete(const AVCodecParameters *par)
+  {
+    if(par->codec_id == AV_CODEC_ID_NONE)
+    {
+      return true;
+    }
+    if(par->codec_type == AVMEDIA_TYPE_VIDEO)
+    {
+      return par->width <= 0 || par->height <= 0 || par->format < 0;
+    }
+    if(par->codec_type == AVMEDIA_TYPE_AUDIO)
+    {
+      return par->sample_rate <= 0 || par->ch_layout.nb_channels <= 0 || par->format < 0;
+    }
+    return false;
+  }
+}
+
+bool save_stream_info(const std::string &cache_path, const std::string &media_path, const AVFormatContext *fmt)
+{
+  int64_t size, mtime;
+  if(!file_identity(media_path, size, mtime))
+  {
+    return false;
+  }
+  StreamCacheHeader header = {};
+  memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  header.version = CACHE_VERSION;
+  header.nb_streams = fmt->nb_streams;
+  header.file_size = size;
+  header.mtime_ns = mtime;
+  std::vector<uint8_t> out((uint8_t *)&header, (uint8_t *)(&header + 1));
+  for(unsigned int i = 0; i < fmt->nb_streams; i++)
+  {
+    const AVStream *st = fmt->streams[i];
+    const AVCodecParameters *par = st->codecpar;
+    CachedStream cs = {};
+    cs.codec_type = par->codec_type;
+    cs.codec_id = par->codec_id;
+    cs.codec_tag = par->codec_tag;
+    cs.format = par->format;
+    cs.bit_rate = par->bit_rate;
+    cs.width = par->width;
+    cs.height = par->height;
+    cs.sample_aspect_ratio = par->sample_aspect_ratio;
+    cs.profile = par->profile;
+    cs.level = par->level;
+    cs.sample_rate = par->sample_rate;
+    cs.nb_channels = par->ch_layout.nb_channels;
+    cs.channel_order = par->ch_layout.order;
+    cs.channel_mask = par->ch_layout.order == AV_CHANNEL_ORDER_NATIVE ? par->ch_layout.u.mask : 0;
+    cs.frame_size = par->frame_size;
+    cs.time_base = st->time_base;
+    cs.avg_frame_rate = st->avg_frame_rate;
+    cs.extradata_size = par->extradata ? par->extradata_size : 0;
+    out.insert(out.end(), (uint8_t *)&cs, (uint8_t *)(&cs + 1));
+    out.insert(out.end(), par->extradata, par->extradata + cs.extradata_size);
+  }
+  //和关键帧索引一样先写临时文件再rename
+  std::string tmp = cache_path + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "wb");
+  if(!f)
+  {
+    return false;
+  }
+  bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+  ok = fclose(f) == 0 && ok;
+  if(!ok || rename(tmp.c_str(), cache_path.c_str()) != 0)
+  {
+    std::cerr << "写入流信息缓存失败:" << cache_path << std::endl;
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool apply_stream_info(const std::string &cache_path, const std::string &media_path, AVFormatContext *fmt)
+{
+  int64_t size, mtime;
+  if(!file_identity(media_path, size, mtime))
+  {
+    return false;
+  }
+  FILE *f = fopen(cache_path.c_str(), "rb");
+  if(!f)
+  {
+    return false;
+  }
+  std::vector<uint8_t> data;
+  uint8_t buf[4096];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), f)) > 0)
+  {
+    data.insert(data.end(), buf, buf + n);
+  }
+  fclose(f);
+
+  StreamCacheHeader header;
+  if(data.size() < sizeof(header))
+  {
+    return false;
+  }
+  memcpy(&header, data.data(), sizeof(header));
+  if(memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION ||
+     header.file_size != size || header.mtime_ns != mtime || header.nb_streams != fmt->nb_streams)
+  {
+    return false;
+  }
+  size_t off = sizeof(header);
+  for(unsigned int i = 0; i < header.nb_streams; i++)
+  {
+    CachedStream cs;
+    if(data.size() < off + sizeof(cs))
+    {
+      return false;
+    }
+    memcpy(&cs, data.data() + off, sizeof(cs));
+    off += sizeof(cs);
+    if(cs.extradata_size < 0 || data.size() < off + cs.extradata_size)
+    {
+      return false;
+    }
+    const uint8_t *extradata = data.data() + off;
+    off += cs.extradata_size;
+
+    AVStream *st = fmt->streams[i];
+    AVCodecParameters *par = st->codecpar;
+    //探测出来的类型和缓存不一致,说明不是同一份文件
+    if(par->codec_type != AVMEDIA_TYPE_UNKNOWN && par->codec_type != cs.codec_type)
+    {
+      return false;
+    }
+    if(!incomplete(par))
+    {
+      continue;
+    }
+    par->codec_type = (AVMediaType)cs.codec_type;
+    par->codec_id = (AVCodecID)cs.codec_id;
+    par->codec_tag = cs.codec_tag;
+    par->format = cs.format;
+    par->bit_rate = cs.bit_rate;
+    par->width = cs.width;
+    par->height = cs.height;
+    par->sample_aspect_ratio = cs.sample_aspect_ratio;
+    par->profile = cs.profile;
+    par->level = cs.level;
+    par->sample_rate = cs.sample_rate;
+    par->frame_size = cs.frame_size;
+    if(cs.nb_channels > 0)
+    {
+      av_channel_layout_uninit(&par->ch_layout);
+      if(cs.channel_order == AV_CHANNEL_ORDER_NATIVE)
+      {
+        av_channel_layout_from_mask(&par->ch_layout, cs.channel_mask);
+      }
+      else
+      {
+        av_channel_layout_default(&par->ch_layout, cs.nb_channels);
+      }
+    }
+    if(par->extradata_size == 0 && cs.extradata_size > 0)
+    {
+      par->extradata = (uint8_t *)av_mallocz(cs.extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+      if(!par->extradata)
+      {
+        return false;
+      }
+      memcpy(par->extradata, extradata, cs.extradata_size);
+      par->extradata_size = cs.extradata_size;
+    }
+    if(st->time_base.num == 0)
+    {
+      st->time_base = cs.time_base;
+    }
+    if(st->avg_frame_rate.num == 0)
+    {
+      st->avg_frame_rate = cs.avg_frame_rate;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <string>
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+/*
+ * 探测结果缓存
+ * avformat_find_stream_info要读很多数据才能确定各路流的参数,同一个文件每次打开都探测一遍很浪费
+ * 第一次完整探测之后把各路流的编码参数存到sidecar文件里,用文件大小和修改时间校验
+ * 再次打开时只做一次很小的探测(让flv之类的格式把流创建出来),缺的参数从缓存里补上
+ */
+
+//把完整探测后的各路流参数写入缓存文件
+bool save_stream_info(const std::string &cache_path, const std::string &media_path, const AVFormatContext *fmt);
+
+//用缓存补齐探测得不完整的流参数,缓存无效或者流对不上时返回false
+bool apply_stream_info(const std::string &cache_path, const std::string &media_path, AVFormatContext *fmt);
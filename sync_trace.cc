@@ -0,0 +1,65 @@
+#include "sync_trace.h"
+#include "clock.h"
+#include <cstdio>
+#include <iostream>
+
+namespace
+{
+  //NAN写成空字段,方便表格软件和脚本直接读
+  void put(FILE *f, double v)
+  {
+    if(std::isnan(v))
+    {
+      fputc(',', f);
+      return;
+    }
+    fprintf(f, ",%.6f", v);
+  }
+}
+
+SyncTrace::SyncTrace() : origin_(monotonic_now())
+{
+  //一个小时的25fps视频大约9万帧,预留空间避免播放过程中反复扩容
+  video_.reserve(1 << 16);
+  audio_.reserve(1 << 16);
+}
+
+double SyncTrace::elapsed() const
+{
+  return monotonic_now() - origin_;
+}
+
+bool SyncTrace::write_csv(const std::string &path) const
+{
+  FILE *f = fopen(path.c_str(), "w");
+  if(!f)
+  {
+    std::cerr << "打开同步记录文件失败:" << path << std::endl;
+    return false;
+  }
+  fprintf(f, "type,time,pts,master,diff,av_diff,delay,actual_delay,dropped,avg_diff,nb_samples,wanted_nb_samples\n");
+  for(const VideoSyncSample &s : video_)
+  {
+    fprintf(f, "video");
+    put(f, s.time);
+    put(f, s.pts);
+    put(f, s.master);
+    put(f, s.diff);
+    put(f, s.av_diff);
+    put(f, s.delay);
+    put(f, s.actual_delay);
+    fprintf(f, ",%d,,,\n", s.dropped ? 1 : 0);
+  }
+  for(const AudioSyncSample &s : audio_)
+  {
+    fprintf(f, "audio");
+    put(f, s.time);
+    put(f, s.audio_clock);
+    put(f, s.master);
+    put(f, s.diff);
+    fprintf(f, ",,,,");
+    put(f, s.avg_diff);
+    fprintf(f, ",%d,%d\n", s.nb_samples, s.wanted_nb_samples);
+  }
+  return fclose(f) == 0;
+}
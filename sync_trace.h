@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//showFrame里每一帧的同步参数,时间都是秒
+struct VideoSyncSample
+{
+  //相对于SyncTrace创建时的单调时钟
+  double time;
+  double pts;
+  //主时钟和diff = pts - 主时钟,视频为主时主时钟就是上一帧的pts
+  double master;
+  double diff;
+  //pts - 音频时钟,即实际听到和看到的偏差,还没有音频时钟时为NAN
+  double av_diff;
+  //同步调整后这一帧的延迟,以及转换上传之后实际还要等待的时间(丢弃的帧为NAN)
+  double delay;
+  double actual_delay;
+  bool dropped;
+};
+
+//synchronize_audio里每一帧的同步参数
+struct AudioSyncSample
+{
+  double time;
+  double audio_clock;
+  double master;
+  //diff = 音频时钟 - 主时钟,avg_diff是指数平均后的误差,还在积累阶段或者音频为主时为NAN
+  double diff;
+  double avg_diff;
+  int nb_samples;
+  int wanted_nb_samples;
+};
+
+/*
+ * 音视频同步的逐帧记录,用来复现和量化同步误差(以前的diff变化图是手工画的)
+ * 视频样本只由渲染线程写,音频样本只由音频解码线程写,播放结束(wait()返回)之后再读取
+ */
+class SyncTrace {
+public:
+  SyncTrace();
+
+  void add_video(const VideoSyncSample &s) { video_.push_back(s); }
+  void add_audio(const AudioSyncSample &s) { audio_.push_back(s); }
+  //相对于创建时的时间(秒)
+  double elapsed() const;
+
+  const std::vector<VideoSyncSample> &video() const { return video_; }
+  const std::vector<AudioSyncSample> &audio() const { return audio_; }
+
+  //写成一个CSV,第一列区分video/audio,两种样本各自用到的列,没有的列留空
+  bool write_csv(const std::string &path) const;
+
+private:
+  double origin_;
+  std::vector<VideoSyncSample> video_;
+  std::vector<AudioSyncSample> audio_;
+};
@@ -0,0 +1,313 @@
+#include "player.h"
+#include "thumbnail.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+/*
+ * 缩略图模式
+ * 以前生成预览图要把整个文件完整解码一遍,这里只解码均匀分布的那几个关键帧:
+ * 每个线程单独打开一份文件,负责连续的一段缩略图,seek到目标时间之前最近的关键帧(有关键帧索引时直接按字节跳),
+ * 解码器设置skip_frame=AVDISCARD_NONKEY,只送关键帧开始的几个包,拿到一帧就缩放进雪碧图里自己的格子
+ * 一个小时的文件取100张缩略图,解码量只有一百来帧,主要开销是seek和读取,分段并行后是秒级的
+ */
+
+namespace
+{
+  //WebVTT的时间格式 HH:MM:SS.mmm
+  std::string vtt_time(double t)
+  {
+    int64_t ms = (int64_t)llround(t * 1000);
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%02lld:%02lld:%02lld.%03lld", (long long)(ms / 3600000), (long long)(ms / 60000 % 60),
+             (long long)(ms / 1000 % 60), (long long)(ms % 1000));
+    return buf;
+  }
+
+  //用ffmpeg自带的mjpeg编码器把雪碧图写成jpeg
+  bool write_jpeg(AVFrame *sheet, const std::string &path, int quality)
+  {
+    const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    if(!codec)
+    {
+      std::cerr << "找不到jpeg编码器" << std::endl;
+      return false;
+    }
+    AVCodecContext *ctx = avcodec_alloc_context3(codec);
+    ctx->width = sheet->width;
+    ctx->height = sheet->height;
+    ctx->pix_fmt = AV_PIX_FMT_YUVJ420P;
+    ctx->time_base = AVRational{1, 25};
+    ctx->flags |= AV_CODEC_FLAG_QSCALE;
+    ctx->global_quality = FF_QP2LAMBDA * quality;
+    bool ok = false;
+    AVPacket *pkt = av_packet_alloc();
+    if(avcodec_open2(ctx, codec, NULL) >= 0)
+    {
+      sheet->quality = ctx->global_quality;
+      sheet->pts = 0;
+      if(avcodec_send_frame(ctx, sheet) >= 0 && avcodec_send_frame(ctx, NULL) >= 0 && avcodec_receive_packet(ctx, pkt) >= 0)
+      {
+        FILE *f = fopen(path.c_str(), "wb");
+        if(f)
+        {
+          ok = fwrite(pkt->data, 1, pkt->size, f) == (size_t)pkt->size;
+          ok = fclose(f) == 0 && ok;
+        }
+      }
+    }
+    if(!ok)
+    {
+      std::cerr << "写入雪碧图失败:" << path << std::endl;
+    }
+    av_packet_free(&pkt);
+    avcodec_free_context(&ctx);
+    return ok;
+  }
+}
+
+bool MediaPlayer::extract_thumbnails(const ThumbnailOptions &opts, ThumbnailStats *stats)  {
+  if(!opened)
+  {
+    return false;
+  }
+  double total = duration();
+  if(total <= 0)
+  {
+    std::cerr << "媒体时长未知,无法均匀地取缩略图" << std::endl;
+    return false;
+  }
+  int count = std::max(1, opts.count);
+  //按显示比例算缩略图的高度,yuv420要求宽高都是偶数
+  double aspect = (double)pCodecCtx->width / pCodecCtx->height;
+  AVRational sar = av_guess_sample_aspect_ratio(pFormatCtx, vStream, NULL);
+  if(sar.num > 0 && sar.den > 0)
+  {
+    aspect *= av_q2d(sar);
+  }
+  int cell_w = std::max(2, opts.width & ~1);
+  int cell_h = std::max(2, (int)lrint(cell_w / aspect) & ~1);
+  int columns = std::max(1, std::min(opts.columns, count));
+  int rows = (count + columns - 1) / columns;
+
+  AVFrame *sheet = av_frame_alloc();
+  sheet->width = cell_w * columns;
+  sheet->height = cell_h * rows;
+  sheet->format = AV_PIX_FMT_YUVJ420P;
+  if(av_frame_get_buffer(sheet, 0) < 0)
+  {
+    std::cerr << "分配雪碧图失败" << std::endl;
+    av_frame_free(&sheet);
+    return false;
+  }
+  //没取到的格子是黑色(jpeg是全范围的yuv)
+  memset(sheet->data[0], 0, sheet->linesize[0] * sheet->height);
+  memset(sheet->data[1], 128, sheet->linesize[1] * sheet->height / 2);
+  memset(sheet->data[2], 128, sheet->linesize[2] * sheet->height / 2);
+
+  //每张缩略图取它那个时间段的中点
+  double start = pFormatCtx->start_time != AV_NOPTS_VALUE ? (double)pFormatCtx->start_time / AV_TIME_BASE : 0;
+  std::vector<double> times(count);
+  for(int i = 0; i < count; i++)
+  {
+    times[i] = start + (i + 0.5) * total / count;
+  }
+  //每一格是否取到了缩略图,各线程只写自己那一段
+  std::vector<char> filled(count, 0);
+  int threads = opts.threads > 0 ? opts.threads : (int)std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min(threads, count);
+
+  //每个线程负责连续的一段,在文件里只往前读,各自写雪碧图里不重叠的格子
+  double begin = monotonic_now();
+  std::vector<ThumbnailStats> parts(threads);
+  std::vector<std::thread> workers;
+  for(int t = 0; t < threads; t++)
+  {
+    int b = count * t / threads;
+    int e = count * (t + 1) / threads;
+    workers.emplace_back([&, t, b, e]() { thumbnail_segment(times, b, e, sheet, cell_w, cell_h, filled, parts[t]); });
+  }
+  for(auto &w : workers)
+  {
+    w.join();
+  }
+  ThumbnailStats st;
+  st.threads = threads;
+  for(const ThumbnailStats &p : parts)
+  {
+    st.packets += p.packets;
+    st.decoded_frames += p.decoded_frames;
+    st.bytes_read += p.bytes_read;
+  }
+  st.thumbnails = (int)std::count(filled.begin(), filled.end(), 1);
+  st.missing = count - st.thumbnails;
+  st.seconds = monotonic_now() - begin;
+
+  bool ok = write_jpeg(sheet, opts.sprite_path, opts.quality);
+  av_frame_free(&sheet);
+
+  //时间戳映射:每个时间段对应雪碧图里的一个矩形,播放器的进度条预览可以直接使用;没取到的格子不写,预览时那一段没有图
+  FILE *f = fopen(opts.map_path.c_str(), "w");
+  if(!f)
+  {
+    std::cerr << "写入时间戳映射失败:" << opts.map_path << std::endl;
+    return false;
+  }
+  size_t slash = opts.sprite_path.find_last_of('/');
+  std::string sprite_name = slash == std::string::npos ? opts.sprite_path : opts.sprite_path.substr(slash + 1);
+  fprintf(f, "WEBVTT\n\n");
+  for(int i = 0; i < count; i++)
+  {
+    if(!filled[i])
+    {
+      continue;
+    }
+    fprintf(f, "%s --> %s\n%s#xywh=%d,%d,%d,%d\n\n", vtt_time(i * total / count).c_str(),
+            vtt_time((i + 1) * total / count).c_str(), sprite_name.c_str(), i % columns * cell_w, i / columns * cell_h,
+            cell_w, cell_h);
+  }
+  fclose(f);
+
+  std::cout << "缩略图: " << st.thumbnails << "张(缺" << st.missing << "张) " << cell_w << "x" << cell_h << " 线程数:"
+            << threads << " 耗时:" << st.seconds << "s 每秒" << st.thumbnails / st.seconds << "张 相当于"
+            << total / st.seconds << "倍速 解码" << st.decoded_frames << "帧 读取"
+            << st.bytes_read / (1024.0 * 1024.0) << "MB" << std::endl;
+  if(stats)
+  {
+    *stats = st;
+  }
+  return ok;
+}
+
+void MediaPlayer::thumbnail_segment(const std::vector<double> &times, int begin,
+                                    int end, AVFrame *sheet, int cell_w, int cell_h, std::vector<char> &filled,
+                                    ThumbnailStats &st)  {
+  MmapIO io;
+  AVFormatContext *fmt = NULL;
+  if(options_.mmap_io && io.open(url_))
+  {
+    fmt = avformat_alloc_context();
+    fmt->pb = io.context();
+  }
+  //只要让demuxer把流建出来,解码参数用主上下文里完整探测过的
+  AVDictionary *format_opts = NULL;
+  av_dict_set_int(&format_opts, "probesize", CACHED_PROBESIZE, 0);
+  av_dict_set_int(&format_opts, "analyzeduration", CACHED_ANALYZEDURATION, 0);
+  int ret = avformat_open_input(&fmt, url_, NULL, &format_opts);
+  av_dict_free(&format_opts);
+  if(ret != 0)
+  {
+    std::cerr << "缩略图线程打开文件失败:" << url_ << std::endl;
+    return;
+  }
+  int video = -1;
+  if(avformat_find_stream_info(fmt, NULL) >= 0)
+  {
+    video = av_find_best_stream(fmt, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+  }
+  if(video < 0)
+  {
+    std::cerr << "缩略图线程找不到视频流" << std::endl;
+    avformat_close_input(&fmt);
+    return;
+  }
+  for(unsigned int i = 0; i < fmt->nb_streams; i++)
+  {
+    if((int)i != video)
+    {
+      fmt->streams[i]->discard = AVDISCARD_ALL;
+    }
+  }
+  AVCodecContext *dec = avcodec_alloc_context3(pCodec);
+  avcodec_parameters_to_context(dec, vStream->codecpar);
+  //并行在各段之间,每段单线程解码;解码器只输出关键帧
+  dec->thread_count = 1;
+  dec->skip_frame = AVDISCARD_NONKEY;
+  if(avcodec_open2(dec, pCodec, NULL) < 0)
+  {
+    std::cerr << "缩略图线程打开解码器失败" << std::endl;
+    avcodec_free_context(&dec);
+    avformat_close_input(&fmt);
+    return;
+  }
+  AVPacket *pkt = av_packet_alloc();
+  AVFrame *frame = av_frame_alloc();
+  SwsContext *sws = NULL;
+  int columns = sheet->width / cell_w;
+  for(int i = begin; i < end; i++)
+  {
+    int64_t target = (int64_t)(times[i] * AV_TIME_BASE);
+    ret = -1;
+    if(index_ready)
+    {
+      const KeyframeEntry *e = keyframe_index->find(target);
+      if(e)
+      {
+        ret = av_seek_frame(fmt, -1, e->pos, AVSEEK_FLAG_BYTE);
+      }
+    }
+    if(ret < 0)
+    {
+      ret = avformat_seek_file(fmt, -1, INT64_MIN, target, target, 0);
+    }
+    if(ret < 0)
+    {
+      continue;
+    }
+    avcodec_flush_buffers(dec);
+    bool got = false;
+    bool key_seen = false;
+    int sent = 0;
+    while(!got && sent < THUMBNAIL_MAX_PACKETS && av_read_frame(fmt, pkt) >= 0)
+    {
+      //关键帧之前的包解码器反正也会跳过,不用送
+      if(pkt->stream_index != video || (!key_seen && !(pkt->flags & AV_PKT_FLAG_KEY)))
+      {
+        av_packet_unref(pkt);
+        continue;
+      }
+      key_seen = true;
+      st.bytes_read += pkt->size;
+      st.packets++;
+      sent++;
+      ret = avcodec_send_packet(dec, pkt);
+      av_packet_unref(pkt);
+      if(ret >= 0 && avcodec_receive_frame(dec, frame) >= 0)
+      {
+        got = true;
+      }
+    }
+    //有重排延迟的解码器要冲一下才会把关键帧吐出来,下一次seek前的flush会把它恢复
+    if(!got && key_seen && avcodec_send_packet(dec, NULL) >= 0 && avcodec_receive_frame(dec, frame) >= 0)
+    {
+      got = true;
+    }
+    if(!got)
+    {
+      continue;
+    }
+    st.decoded_frames++;
+    sws = sws_getCachedContext(sws, frame->width, frame->height, (AVPixelFormat)frame->format, cell_w, cell_h,
+                               AV_PIX_FMT_YUVJ420P, SWS_BILINEAR, NULL, NULL, NULL);
+    if(!sws)
+    {
+      std::cerr << "创建缩略图缩放上下文失败" << std::endl;
+      av_frame_unref(frame);
+      break;
+    }
+    //直接缩放到雪碧图里这一格的位置
+    int x = i % columns * cell_w;
+    int y = i / columns * cell_h;
+    uint8_t *dst[4] = {sheet->data[0] + y * sheet->linesize[0] + x, sheet->data[1] + y / 2 * sheet->linesize[1] + x / 2,
+                       sheet->data[2] + y / 2 * sheet->linesize[2] + x / 2, NULL};
+    sws_scale(sws, (const uint8_t *const *)frame->data, frame->linesize, 0, frame->height, dst, sheet->linesize);
+    filled[i] = 1;
+    av_frame_unref(frame);
+  }
+  sws_freeContext(sws);
+  av_frame_free(&frame);
+  av_packet_free(&pkt);
+  avcodec_free_context(&dec);
+  avformat_close_input(&fmt);
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+//缩略图模式的参数,见MediaPlayer::extract_thumbnails
+struct ThumbnailOptions
+{
+  //在整个时长上均匀分布的缩略图张数
+  int count{100};
+  //每张缩略图的宽度,高度按视频的显示比例算出来,都取偶数
+  int width{160};
+  //雪碧图每行放几张
+  int columns{10};
+  //并行解码的线程数,0表示按cpu核数
+  int threads{0};
+  //jpeg的量化参数,2~31,越小画质越好
+  int quality{5};
+  //雪碧图(jpeg)和时间戳映射(WebVTT,每个时间段对应雪碧图里的一个矩形)的输出路径
+  std::string sprite_path{"sprite.jpg"};
+  std::string map_path{"sprite.vtt"};
+};
+
+//缩略图提取的结果和吞吐量
+struct ThumbnailStats
+{
+  int thumbnails{0};
+  //seek失败或者解码不出关键帧的格子,在雪碧图里留黑
+  int missing{0};
+  int threads{0};
+  double seconds{0};
+  //送进解码器的包数,解码出来的帧数,读取的视频数据量
+  uint64_t packets{0};
+  uint64_t decoded_frames{0};
+  uint64_t bytes_read{0};
+};